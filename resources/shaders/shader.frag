@@ -1,11 +1,18 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec2 texCoord;
 
 layout(location = 0) out vec4 outColor;
 
-layout(set = 1, binding = 1) uniform sampler2DArray image;
+layout(push_constant) uniform Push {
+    vec2 offset;
+    vec3 color_diff;
+    uint textureIndex;
+} push;
+
+layout(set = 1, binding = 1) uniform sampler2DArray textures[];
 
 void main() {
-    outColor = texture(image, vec3(texCoord, 0));
-}
\ No newline at end of file
+    outColor = texture(textures[push.textureIndex], vec3(texCoord, 0));
+}
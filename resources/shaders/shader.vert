@@ -5,12 +5,13 @@ layout(location = 1) in vec2 texCoord;
 
 layout(location = 0) out vec2 fragtexCoord;
 
-layout(set = 0, binding = 0) uniform GlobalUbo {
+layout(push_constant) uniform Push {
     vec2 offset;
     vec3 color_diff;
-} ubo;
+    uint textureIndex;
+} push;
 
 void main() {
-    gl_Position = vec4(position + ubo.offset, 0.0, 1.0);
+    gl_Position = vec4(position + push.offset, 0.0, 1.0);
     fragtexCoord = texCoord;
-}
\ No newline at end of file
+}
@@ -0,0 +1,20 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec2 texCoord;
+layout(location = 1) in float layer;
+layout(location = 2) in vec4 color;
+layout(location = 3) flat in uint textureIndex;
+
+layout(location = 0) out vec4 outColor;
+
+layout(set = 1, binding = 1) uniform sampler2DArray textures[];
+
+// Untinted sprites get a pipeline without the color multiply.
+layout(constant_id = 0) const bool TINT = true;
+
+void main() {
+    outColor = texture(textures[nonuniformEXT(textureIndex)], vec3(texCoord, layer));
+    if(TINT)
+        outColor *= color;
+}
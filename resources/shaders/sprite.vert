@@ -0,0 +1,26 @@
+#version 450
+
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 texCoord;
+
+// Per instance, see SpriteInstance.
+layout(location = 2) in vec2 offset;
+layout(location = 3) in vec2 scale;
+layout(location = 4) in vec4 rotationLayerTexture;
+layout(location = 5) in vec4 color;
+
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) out float fragLayer;
+layout(location = 2) out vec4 fragColor;
+layout(location = 3) flat out uint fragTexture;
+
+void main() {
+    float s = sin(rotationLayerTexture.x);
+    float c = cos(rotationLayerTexture.x);
+    vec2 scaled = position * scale;
+    gl_Position = vec4(offset + vec2(c * scaled.x - s * scaled.y, s * scaled.x + c * scaled.y), 0.0, 1.0);
+    fragTexCoord = texCoord;
+    fragLayer = rotationLayerTexture.y;
+    fragTexture = uint(rotationLayerTexture.z);
+    fragColor = color;
+}
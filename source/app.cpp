@@ -3,18 +3,27 @@
 #include "es_vulkan.h"
 #include "logger.h"
 #include "source/vulkan_texture.h"
+#include "draw_queue.h"
 #include "vulkan_buffer.h"
 #include "vulkan_descriptors.h"
 #include "vulkan_device.h"
+#include "vulkan_layout_cache.h"
 #include "vulkan_model.h"
 #include "vulkan_pipeline.h"
+#include "vulkan_pipeline_cache.h"
+#include "vulkan_shader_library.h"
 #include "vulkan_swapchain.h"
+#include "vulkan_upload_batch.h"
 #include "window.h"
 
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <numeric>
 #include <stdexcept>
@@ -26,53 +35,113 @@
 #include <chrono>
 
 namespace {
-	int texId;
+	uint32_t texId;
+
+	// Ids of the sort key, see DrawQueue::MakeKey.
+	enum DrawLayer : uint32_t { LAYER_TRIANGLES, LAYER_SPRITES };
+	enum ModelId : uint32_t { MODEL_TRIANGLE, MODEL_QUAD };
+
+	// Matches the push constant block of shader.vert and shader.frag.
+	struct TrianglePushConstants {
+		float offset[2];
+		float padding[2];
+		float color[3];
+		uint32_t texture;
+	};
+	// The texture index is a uint, which is laid out like a float.
+	using TrianglePushLayout = BlockDescription<BlockLayout::STD430,
+		AttributeSize::VECTOR_TWO, AttributeSize::VECTOR_THREE, AttributeSize::SIMPLE_FLOAT>;
+	static_assert(TrianglePushLayout::OFFSET<1> == offsetof(TrianglePushConstants, color), "push constant color offset mismatch");
+	static_assert(TrianglePushLayout::OFFSET<2> == offsetof(TrianglePushConstants, texture), "push constant texture offset mismatch");
+	static_assert(TrianglePushLayout::SIZE == sizeof(TrianglePushConstants), "push constant size mismatch");
+
+	// Position and texture coordinate of the triangle and the sprite quad.
+	using TexturedVertexLayout = BlockDescription<BlockLayout::VERTEX, AttributeSize::HALF_TWO, AttributeSize::UNORM16_TWO>;
+
+	// Logs the nearest rank percentiles of a list of frame times in milliseconds.
+	void LogFrameTimes(const std::string &name, std::vector<double> times)
+	{
+		if(times.empty())
+		{
+			Logger::Status(name + " frame time: no frames measured");
+			return;
+		}
+		std::sort(times.begin(), times.end());
+		auto percentile = [&times](double percent) {
+			size_t rank = static_cast<size_t>(std::ceil(percent / 100. * times.size()));
+			return times[std::max<size_t>(rank, 1) - 1];
+		};
+		Logger::Status(name + " frame time over " + std::to_string(times.size()) + " frames: p50 "
+			+ std::to_string(percentile(50.)) + " ms, p95 " + std::to_string(percentile(95.)) + " ms, p99 "
+			+ std::to_string(percentile(99.)) + " ms");
+	}
 }
 
 
 
-App::App(const std::string &name, uint width, uint height)
-: width(width), height(height), window(width, height, name), device(window)
+App::App(const std::string &name, uint width, uint height, uint32_t benchmarkFrames)
+: width(width), height(height), window(width, height, name, benchmarkFrames > 0), device(window), drawQueue(threadPool),
+	benchmarkFrames(benchmarkFrames)
 {
+	// Every asset loaded during startup is recorded into this batch and submitted together.
+	VulkanUploadBatch uploads(device);
+
+	pipelineRegistry = std::make_unique<VulkanPipelineRegistry>(device, compilePool);
+	textureRegistry = std::make_unique<VulkanTextureRegistry>(device);
+	geometryArena = std::make_unique<VulkanGeometryArena>(device);
 	std::vector<std::string> paths = {"../../resources/textures/anti-missile hai.png"};
-	texId = LoadTexture(paths, 1);
-	CreateTextureDescriptors();
+	texId = LoadTexture(uploads, paths);
 
 
 
 	pipelineDescriptions.emplace_back();
-	pipelineDescriptions[0].shaderInfo.attributeLayout = {
-		AttributeSize::VECTOR_TWO,
-		AttributeSize::VECTOR_TWO,
-	};
-	pipelineDescriptions[0].shaderInfo.uniformLayout = {
-		AttributeSize::VECTOR_TWO,
-		AttributeSize::VECTOR_THREE,
-	};
+	pipelineDescriptions[0].critical = true;
+	pipelineDescriptions[0].shaderInfo.attributeLayout = TexturedVertexLayout::Fields();
+	pipelineDescriptions[0].shaderInfo.pushConstantLayout = TrianglePushLayout::Fields();
 	pipelineDescriptions[0].shaderInfo.vertexShaderFilename = "../../resources/shaders/shader.vert.spv";
 	pipelineDescriptions[0].shaderInfo.fragmentShaderFilename = "../../resources/shaders/shader.frag.spv";
 	pipelineDescriptions[0].pipelineShaderInfo = VulkanPipeline::PrepareShaderInfo(device, pipelineDescriptions[0].shaderInfo,
-		VulkanSwapChain::MAX_FRAMES_IN_FLIGHT);
-	CreatePipelineLayout(pipelineDescriptions[0]);
-	triangle.model = std::make_unique<VulkanModel>(device, triangle.vertices, pipelineDescriptions[0].shaderInfo.attributeLayout);
+		VulkanSwapChain::MAX_FRAMES_IN_FLIGHT, ExternalSets());
+	triangle.model = std::make_unique<VulkanModel>(*geometryArena, uploads, triangle.vertices, pipelineDescriptions[0].shaderInfo.attributeLayout);
 
+	pipelineDescriptions.emplace_back();
+	pipelineDescriptions[1].shaderInfo.attributeLayout = TexturedVertexLayout::Fields();
+	pipelineDescriptions[1].shaderInfo.instanceLayout = SpriteBatch::InstanceLayout::Fields();
+	pipelineDescriptions[1].shaderInfo.vertexShaderFilename = "../../resources/shaders/sprite.vert.spv";
+	pipelineDescriptions[1].shaderInfo.fragmentShaderFilename = "../../resources/shaders/sprite.frag.spv";
+	pipelineDescriptions[1].pipelineShaderInfo = VulkanPipeline::PrepareShaderInfo(device, pipelineDescriptions[1].shaderInfo,
+		VulkanSwapChain::MAX_FRAMES_IN_FLIGHT, ExternalSets());
+	quad.model = std::make_unique<VulkanModel>(*geometryArena, uploads, quad.vertices, pipelineDescriptions[1].shaderInfo.attributeLayout,
+		quad.indices);
+	spriteBatch = std::make_unique<SpriteBatch>(*quad.model);
 
+	uploads.Submit();
+	Logger::Status("Startup uploads took " + std::to_string(uploads.GetSubmitCount()) + " submits");
 
-	RecreateSwapChain();
-	CreateCommandBuffers();
-}
 
 
-App::~App()
-{
-	for(auto &pipelineDescription : pipelineDescriptions)
-		vkDestroyPipelineLayout(device.Device(), pipelineDescription.pipelineLayout, nullptr);
+	RecreateSwapChain();
+	recorder = std::make_unique<VulkanParallelRecorder>(threadPool);
+	CreateFrameContexts();
+	if(benchmarkFrames)
+		gpuTimer = std::make_unique<VulkanGpuTimer>(device, VulkanSwapChain::MAX_FRAMES_IN_FLIGHT);
+
+	device.Allocator().LogStats();
+	device.LayoutCache().LogStats();
+	device.PipelineCache().LogStats();
+	pipelineRegistry->LogStats();
+	geometryArena->LogStats();
 }
 
 
-
 void App::Run()
 {	
+	if(benchmarkFrames)
+	{
+		RunBenchmark();
+		return;
+	}
+
 	while(!window.ShouldClose())
 	{
 		glfwPollEvents();
@@ -85,49 +154,31 @@ void App::Run()
 
 
 
-void App::CreateTextureDescriptors()
+void App::RunBenchmark()
 {
-	auto minOffsetAlignment = std::lcm(
-		device.properties.limits.minUniformBufferOffsetAlignment,
-		device.properties.limits.nonCoherentAtomSize);
-
-	desriptorPool = VulkanDescriptorPool::Builder(device)
-		.SetMaxSets(VulkanSwapChain::MAX_FRAMES_IN_FLIGHT)
-		.AddPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VulkanSwapChain::MAX_FRAMES_IN_FLIGHT)
-		.Build();
-	desriptorSetLayout = VulkanDescriptorSetLayout::Builder(device)
-		.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-		.Build();
-	for(int j = 0; j < VulkanSwapChain::MAX_FRAMES_IN_FLIGHT; j++)
+	Logger::Status("Rendering " + std::to_string(benchmarkFrames) + " headless frames");
+	using Milliseconds = std::chrono::duration<double, std::milli>;
+	cpuFrameTimes.reserve(benchmarkFrames);
+	gpuFrameTimes.reserve(benchmarkFrames);
+	for(uint32_t i = 0; i < benchmarkFrames; i++)
 	{
-		descriptorSets.emplace_back();
-		VkDescriptorImageInfo imageInfo{};
-		imageInfo.imageLayout = textures[0][texId]->GetImageLayout();
-		imageInfo.imageView = textures[0][texId]->GetImageView();
-		imageInfo.sampler = textures[0][texId]->GetSampler();
-		VulkanDescriptorWriter(*desriptorSetLayout, *desriptorPool)
-			.WriteImage(1, &imageInfo)
-			.Build(descriptorSets.back());
+		auto start = std::chrono::steady_clock::now();
+		DrawFrame();
+		cpuFrameTimes.push_back(Milliseconds(std::chrono::steady_clock::now() - start - frameStall).count());
 	}
-}
-
-
 
-void App::CreatePipelineLayout(VulkanPipelineDescription &pipelineDescription)
-{
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts{
-		pipelineDescription.pipelineShaderInfo.desriptorSetLayout->GetDescriptorSetLayout(),
-		desriptorSetLayout->GetDescriptorSetLayout()
-	};
-
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
-	pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;
-	if(vkCreatePipelineLayout(device.Device(), &pipelineLayoutInfo, nullptr, &pipelineDescription.pipelineLayout) != VK_SUCCESS)
-		throw std::runtime_error("failed to create pipline layout");
+	// The timestamps of the frames still in flight are only read once they completed.
+	vkDeviceWaitIdle(device.Device());
+	double gpuTime;
+	for(uint32_t slot = 0; slot < VulkanSwapChain::MAX_FRAMES_IN_FLIGHT; slot++)
+		if(gpuTimer->Read(slot, gpuTime))
+			gpuFrameTimes.push_back(gpuTime);
+
+	LogFrameTimes("CPU", cpuFrameTimes);
+	if(gpuTimer->IsSupported())
+		LogFrameTimes("GPU", gpuFrameTimes);
+	else
+		Logger::Status("GPU frame time: timestamps are not supported by the graphics queue");
 }
 
 
@@ -147,74 +198,172 @@ void App::RecreateSwapChain()
 		swapChain = std::make_unique<VulkanSwapChain>(device, extent);
 	else
 	{
-		swapChain = std::make_unique<VulkanSwapChain>(device, extent, std::move(swapChain));
-		if(swapChain->ImageCount() != commandBuffers.size())
+		std::shared_ptr<VulkanSwapChain> previous = std::move(swapChain);
+		swapChain = std::make_unique<VulkanSwapChain>(device, extent, previous);
+		// The previous render pass is destroyed with its swap chain unless the new one took it over.
+		// Background compiles may still be creating pipelines with it, so those have to finish first.
+		if(previous->GetRenderPassKey() != swapChain->GetRenderPassKey())
+			pipelineRegistry->WaitForCompiles(previous->GetRenderPass());
+	}
+
+	// Viewport and scissor are dynamic state, so a pipeline only depends on the render pass it is compatible with.
+	if(pipelineRenderPass != swapChain->GetRenderPassKey())
+	{
+		// Pipelines for the old render pass cannot stand in for the new ones. All of them compile in parallel,
+		// but only the critical ones hold up the next frame, the others are skipped until they are ready.
+		pipelineRequestTime = std::chrono::steady_clock::now();
+		pendingPipelines.clear();
+		for(auto &pipelineDescription : pipelineDescriptions)
+		{
+			pipelineDescription.pipeline = pipelineRegistry->Acquire(PipelineRequest(pipelineDescription, VulkanRenderState(),
+				pipelineDescription.shaderInfo.specialization));
+			pipelineDescription.variants.clear();
+			if(!pipelineDescription.critical)
+				pendingPipelines.push_back(pipelineDescription.pipeline.GetFuture());
+		}
+		for(auto &pipelineDescription : pipelineDescriptions)
 		{
-			FreeCommandBuffers();
-			CreateCommandBuffers();
+			if(!pipelineDescription.critical)
+				continue;
+			pipelineDescription.pipeline.Wait();
+			if(!pipelineDescription.pipeline.Get())
+				throw std::runtime_error("failed to create graphics pipeline!");
 		}
+		pipelineRenderPass = swapChain->GetRenderPassKey();
 	}
-
-	for(auto &pipelineDescription : pipelineDescriptions)
-		CreatePipeline(pipelineDescription);
 }
 
 
 
-void App::CreatePipeline(VulkanPipelineDescription &pipelineDescription)
+VulkanPipelineRegistry::Request App::PipelineRequest(const VulkanPipelineDescription &pipelineDescription,
+	const VulkanRenderState &renderState, const SpecializationConstants &specialization)
 {
 	assert(swapChain != nullptr && "Cannot create pipeline before swap chain");
-	assert(pipelineDescription.pipelineLayout != nullptr && "Cannot create pipeline before pipeline layout");
-	VulkanPipelineConfigInfo pipelineConfig{};
-  	VulkanPipeline::DefaultPipelineConfigInfo(pipelineConfig);
-	pipelineConfig.renderPass = swapChain->GetRenderPass();
-	pipelineConfig.pipelineLayout = pipelineDescription.pipelineLayout;
-	pipelineDescription.pipeline = std::make_unique<VulkanPipeline>(
-		device,
-		pipelineDescription.shaderInfo.vertexShaderFilename,
-		pipelineDescription.shaderInfo.fragmentShaderFilename,
-		pipelineConfig,
-		pipelineDescription.shaderInfo.attributeLayout);
+	assert(pipelineDescription.pipelineShaderInfo.pipelineLayout != nullptr && "Cannot create pipeline before pipeline layout");
+	VulkanPipelineRegistry::Request request;
+	request.vertexShaderFilename = pipelineDescription.shaderInfo.vertexShaderFilename;
+	request.fragmentShaderFilename = pipelineDescription.shaderInfo.fragmentShaderFilename;
+	request.attributeLayout = pipelineDescription.shaderInfo.attributeLayout;
+	request.instanceLayout = pipelineDescription.shaderInfo.instanceLayout;
+	request.pipelineLayout = pipelineDescription.pipelineShaderInfo.pipelineLayout;
+	request.renderState = renderState;
+	request.specialization = specialization;
+	request.renderPass = swapChain->GetRenderPass();
+	request.renderPassKey = swapChain->GetRenderPassKey();
+	return request;
 }
 
 
 
-void App::CreateCommandBuffers()
+VulkanPipeline *App::GetPipelineVariant(VulkanPipelineDescription &pipelineDescription, const VulkanRenderState &renderState,
+	const SpecializationConstants &specialization)
 {
-	commandBuffers.resize(swapChain->ImageCount());
+	VulkanRenderState baked = VulkanPipeline::BakedRenderState(device, renderState);
+	if(baked == VulkanPipeline::BakedRenderState(device, VulkanRenderState())
+			&& specialization == pipelineDescription.shaderInfo.specialization)
+		return pipelineDescription.pipeline.Get();
+
+	VulkanPipelineRegistry::Handle &variant = pipelineDescription.variants[{baked, specialization}];
+	if(!variant)
+		variant = pipelineRegistry->Acquire(PipelineRequest(pipelineDescription, baked, specialization),
+			pipelineDescription.pipeline);
+	return variant.Get();
+}
+
+
+
+std::map<uint32_t, VulkanDescriptorSetLayout *> App::ExternalSets()
+{
+	// Every other set layout is reflected from the shaders, only the texture table is owned by the app.
+	return {{VulkanTextureRegistry::SET, &textureRegistry->GetDescriptorSetLayout()}};
+}
+
+
+
+void App::ReloadShaders()
+{
+	std::vector<std::string> changed = device.ShaderLibrary().PollChanges();
+	if(changed.empty())
+		return;
+
+	for(VulkanPipelineDescription &pipelineDescription : pipelineDescriptions)
+	{
+		const ShaderInfo &shaderInfo = pipelineDescription.shaderInfo;
+		if(std::find(changed.begin(), changed.end(), shaderInfo.vertexShaderFilename) == changed.end()
+				&& std::find(changed.begin(), changed.end(), shaderInfo.fragmentShaderFilename) == changed.end())
+			continue;
 
-	VkCommandBufferAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = device.GetCommandPool();
-	allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+		// Pipeline layouts, uniform rings and vertex layouts stay as they are, a shader that changes them needs a restart.
+		try
+		{
+			VulkanShaderLibrary &shaders = device.ShaderLibrary();
+			SpirvReflection reloaded = shaders.Load(shaderInfo.vertexShaderFilename)->reflection;
+			reloaded.Merge(shaders.Load(shaderInfo.fragmentShaderFilename)->reflection);
+			if(!reloaded.SameInterface(pipelineDescription.pipelineShaderInfo.reflection))
+			{
+				Logger::Error("Shader interface of " + shaderInfo.vertexShaderFilename + " changed, restart to apply it");
+				continue;
+			}
+		}
+		catch(const std::exception &error)
+		{
+			Logger::Error("Reloaded shaders do not fit " + shaderInfo.vertexShaderFilename + ": " + error.what());
+			continue;
+		}
 
-	if (vkAllocateCommandBuffers(device.Device(), &allocInfo, commandBuffers.data()) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate command buffers!");
+		// Every pipeline keeps drawing with its old shaders until the new one is compiled.
+		pipelineDescription.pipeline = pipelineRegistry->Acquire(PipelineRequest(pipelineDescription, VulkanRenderState(),
+			shaderInfo.specialization), pipelineDescription.pipeline);
+		for(auto &variant : pipelineDescription.variants)
+			variant.second = pipelineRegistry->Acquire(PipelineRequest(pipelineDescription, variant.first.first,
+				variant.first.second), variant.second);
+	}
 }
 
 
 
-void App::FreeCommandBuffers()
+void App::CreateFrameContexts()
 {
-	vkFreeCommandBuffers(device.Device(), device.GetCommandPool(), static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-	commandBuffers.clear();
+	for(int i = 0; i < VulkanSwapChain::MAX_FRAMES_IN_FLIGHT; i++)
+		frameContexts.emplace_back(std::make_unique<VulkanFrameContext>(device, recorder->GetMaxChunkCount()));
 }
 
 
 
 void App::DrawFrame()
 {
+	frameStall = {};
 	uint32_t imageIndex;
 	auto result = swapChain->AcquireNextImage(&imageIndex);
 
 	if(result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
 		RecreateSwapChain();
+		return;
+	}
 	if(result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
 		throw std::runtime_error("failed to acquire swap chain image");
 
-	RecordCommandBuffer(imageIndex);
-	result = swapChain->SubmitCommandBuffers(&commandBuffers[imageIndex], &imageIndex);
+	pipelineRegistry->Collect();
+	ReloadShaders();
+	VulkanFrameContext &frame = *frameContexts[swapChain->GetCurrentFrame()];
+	frame.Begin();
+	// The slot's previous frame completed in Begin(), so its timestamps are available.
+	double gpuTime;
+	if(gpuTimer && gpuTimer->Read(swapChain->GetCurrentFrame(), gpuTime))
+		gpuFrameTimes.push_back(gpuTime);
+	drawQueue.Clear();
+	QueueTriangles();
+	FillSpriteBatch();
+	spriteBatch->Queue(frame, drawQueue);
+	drawQueue.Sort();
+	RecordCommandBuffer(frame, imageIndex);
+
+	VkCommandBuffer commandBuffer = frame.GetCommandBuffer();
+	result = swapChain->SubmitCommandBuffers(&commandBuffer, &imageIndex);
+	frame.MarkSubmitted(device.SubmittedFrame());
+	ReportFrameStats();
+	ReportPipelineProgress();
 	if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || window.WasWindowResized())
 	{
 		RecreateSwapChain();
@@ -228,12 +377,15 @@ void App::DrawFrame()
 
 
 
-void App::RecordCommandBuffer(int imageIndex)
+void App::RecordCommandBuffer(VulkanFrameContext &frame, int imageIndex)
 {
 	VkCommandBufferBeginInfo beginInfo{};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	if (vkBeginCommandBuffer(commandBuffers[imageIndex], &beginInfo) != VK_SUCCESS)
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(frame.GetCommandBuffer(), &beginInfo) != VK_SUCCESS)
 		throw std::runtime_error("failed to begin recording command buffer!");
+	if(gpuTimer)
+		gpuTimer->Begin(frame.GetCommandBuffer(), swapChain->GetCurrentFrame());
 
 	VkRenderPassBeginInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -247,8 +399,79 @@ void App::RecordCommandBuffer(int imageIndex)
 	clearValues[1].depthStencil = {1.0f, 0};
 	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
-	vkCmdBeginRenderPass(commandBuffers[imageIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
+	for(auto &pipelineDescription : pipelineDescriptions)
+		if(pipelineDescription.pipelineShaderInfo.uniformRing)
+			pipelineDescription.pipelineShaderInfo.uniformRing->BeginFrame(swapChain->GetCurrentFrame());
+
+	recorder->Record(frame, renderPassInfo, drawQueue.GetDrawCount(),
+		[this](VkCommandBuffer commandBuffer, size_t begin, size_t end) { RecordDraws(commandBuffer, begin, end); });
+
+	for(auto &pipelineDescription : pipelineDescriptions)
+		if(pipelineDescription.pipelineShaderInfo.uniformRing)
+			pipelineDescription.pipelineShaderInfo.uniformRing->Flush();
+
+	if(gpuTimer)
+		gpuTimer->End(frame.GetCommandBuffer(), swapChain->GetCurrentFrame());
+	if (vkEndCommandBuffer(frame.GetCommandBuffer()) != VK_SUCCESS)
+		throw std::runtime_error("failed to record command buffer!");
+}
+
+
+
+void App::ReportFrameStats()
+{
+	auto stall = device.TakeStallTime();
+	frameStall = stall;
+	stallTotal += stall;
+	stallMax = std::max(stallMax, stall);
+	if(++stallFrames < REPORT_FRAMES)
+		return;
+
+	using Milliseconds = std::chrono::duration<double, std::milli>;
+	Logger::Status("CPU stall per frame: " + std::to_string(Milliseconds(stallTotal).count() / stallFrames)
+		+ " ms average, " + std::to_string(Milliseconds(stallMax).count()) + " ms max");
+
+	// Bind counts of the last frame, before and after skipping redundant binds.
+	DrawQueue::BindCounts requested = drawQueue.GetRequestedBinds();
+	DrawQueue::BindCounts issued = drawQueue.GetIssuedBinds();
+	Logger::Status("Binds per frame for " + std::to_string(drawQueue.GetDrawCount()) + " draws: "
+		+ std::to_string(requested.pipelines) + " -> " + std::to_string(issued.pipelines) + " pipelines, "
+		+ std::to_string(requested.descriptorSets) + " -> " + std::to_string(issued.descriptorSets) + " descriptor sets, "
+		+ std::to_string(requested.vertexBuffers) + " -> " + std::to_string(issued.vertexBuffers) + " vertex buffers, "
+		+ std::to_string(requested.indexBuffers) + " -> " + std::to_string(issued.indexBuffers) + " index buffers, "
+		+ std::to_string(requested.renderStates) + " -> " + std::to_string(issued.renderStates) + " render states");
+	stallFrames = 0;
+	stallTotal = {};
+	stallMax = {};
+}
+
+
+
+void App::ReportPipelineProgress()
+{
+	using Milliseconds = std::chrono::duration<double, std::milli>;
+	auto now = std::chrono::steady_clock::now();
+	if(!firstFramePresented)
+	{
+		firstFramePresented = true;
+		Logger::Status("Time to first frame: " + std::to_string(Milliseconds(now - startTime).count()) + " ms, "
+			+ std::to_string(pipelineRegistry->GetCompilingCount()) + " pipelines still compiling");
+	}
+
+	if(pendingPipelines.empty())
+		return;
+	for(auto it = pendingPipelines.begin(); it != pendingPipelines.end(); )
+		it = it->wait_for(std::chrono::seconds(0)) == std::future_status::ready ? pendingPipelines.erase(it) : it + 1;
+	if(pendingPipelines.empty())
+		Logger::Status("Background pipelines ready after " + std::to_string(Milliseconds(now - pipelineRequestTime).count())
+			+ " ms");
+}
+
+
+
+void App::RecordDraws(VkCommandBuffer commandBuffer, size_t begin, size_t end)
+{
 	VkViewport viewport{};
 	viewport.x = 0.0f;
 	viewport.y = 0.0f;
@@ -257,60 +480,88 @@ void App::RecordCommandBuffer(int imageIndex)
 	viewport.minDepth = 0.0f;
 	viewport.maxDepth = 1.0f;
 	VkRect2D scissor{{0, 0}, swapChain->GetSwapChainExtent()};
-	vkCmdSetViewport(commandBuffers[imageIndex], 0, 1, &viewport);
-	vkCmdSetScissor(commandBuffers[imageIndex], 0, 1, &scissor);
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-	pipelineDescriptions[0].pipeline->Bind(commandBuffers[imageIndex]);
-	triangle.model->Bind(commandBuffers[imageIndex]);
+	drawQueue.Record(commandBuffer, begin, end);
+}
 
-	vkCmdBindDescriptorSets(
-			commandBuffers[imageIndex],
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			pipelineDescriptions[0].pipelineLayout,
-			1,
-			1,
-			&descriptorSets[imageIndex],
-			0,
-			nullptr);
 
 
-	std::vector<uint32_t> offsets = pipelineDescriptions[0].pipelineShaderInfo.GetDynamicOffsets(imageIndex, 4);
+void App::QueueTriangles()
+{
+	DrawPacket packet;
+	packet.key = DrawQueue::MakeKey(LAYER_TRIANGLES, BlendMode::SOLID, 0, texId, MODEL_TRIANGLE);
+	packet.pipeline = pipelineDescriptions[0].pipeline.Get();
+	if(!packet.pipeline)
+		return;
+	packet.pipelineLayout = pipelineDescriptions[0].pipelineShaderInfo.pipelineLayout;
+	packet.textureSet = textureRegistry->GetDescriptorSet();
+	packet.model = triangle.model.get();
+	packet.shaderInfo = &pipelineDescriptions[0].pipelineShaderInfo;
 
-	for(int j = 0; j < 4; j++)
+	for(size_t j = 0; j < triangleDraws; j++)
 	{
-		std::vector<float> uniformData = {
-			0.0f, -0.1f * j, 0.0f, 0.0f, // offset
-			0.1f * j,  0.0f, 0.25f * j, // color
+		TrianglePushConstants pushData = {
+			{0.0f, -0.1f * j}, {0.0f, 0.0f},
+			{0.1f * j,  0.0f, 0.25f * j},
+			texId,
 		};
-
-		uint32_t bufferIndex = (pipelineDescriptions[0].pipelineShaderInfo.bufferCount * imageIndex) + j;
-		pipelineDescriptions[0].pipelineShaderInfo.uniformBuffer->WriteToIndex(uniformData.data(), bufferIndex);
-		pipelineDescriptions[0].pipelineShaderInfo.uniformBuffer->FlushIndex(bufferIndex);
-
-		vkCmdBindDescriptorSets(
-			commandBuffers[imageIndex],
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			pipelineDescriptions[0].pipelineLayout,
-			0,
-			1,
-			&pipelineDescriptions[0].pipelineShaderInfo.descriptorSets[bufferIndex],
-			1,
-			offsets.data());
-		
-		triangle.model->Draw(commandBuffers[imageIndex]);
+		drawQueue.Add(packet, &pushData, sizeof(pushData));
 	}
+}
 
-	vkCmdEndRenderPass(commandBuffers[imageIndex]);
 
-	if (vkEndCommandBuffer(commandBuffers[imageIndex]) != VK_SUCCESS)
-		throw std::runtime_error("failed to record command buffer!");
+
+void App::FillSpriteBatch()
+{
+	// A grid of small spinning sprites sharing one texture. Every other row is untinted and alpha blended, drawn with
+	// a pipeline that has the tint compiled out, so the grid ends up in two draws.
+	constexpr int GRID = 32;
+	float angle = static_cast<float>(device.SubmittedFrame() % 360) * 0.0174533f;
+
+	VulkanPipelineDescription &spriteDescription = pipelineDescriptions[1];
+	SpecializationConstants untinted = spriteDescription.shaderInfo.specialization;
+	untinted.Set(SpriteBatch::TINT_CONSTANT, false);
+	VulkanRenderState renderStates[2];
+	renderStates[1].blend = BlendMode::ALPHA;
+	VulkanPipeline *pipelines[] = {
+		GetPipelineVariant(spriteDescription, renderStates[0], spriteDescription.shaderInfo.specialization),
+		GetPipelineVariant(spriteDescription, renderStates[1], untinted),
+	};
+	uint64_t keys[] = {
+		DrawQueue::MakeKey(LAYER_SPRITES, renderStates[0].blend, 1, texId, MODEL_QUAD),
+		DrawQueue::MakeKey(LAYER_SPRITES, renderStates[1].blend, 2, texId, MODEL_QUAD),
+	};
+	spriteBatch->Clear();
+	for(int y = 0; y < GRID; y++)
+		for(int x = 0; x < GRID; x++)
+		{
+			// Sprites whose pipeline is still compiling are left out.
+			int variant = y % 2;
+			if(!pipelines[variant])
+				continue;
+
+			SpriteInstance sprite{};
+			sprite.offset[0] = -0.95f + 1.9f * x / (GRID - 1);
+			sprite.offset[1] = 0.2f + 0.75f * y / (GRID - 1);
+			sprite.scale[0] = 0.04f;
+			sprite.scale[1] = 0.04f;
+			sprite.rotation = angle + 0.1f * (x + y);
+			sprite.layer = 0.0f;
+			sprite.texture = static_cast<float>(texId);
+			sprite.color[0] = static_cast<float>(x) / GRID;
+			sprite.color[1] = static_cast<float>(y) / GRID;
+			sprite.color[2] = 1.0f;
+			sprite.color[3] = 1.0f;
+			spriteBatch->Add(keys[variant], *pipelines[variant], renderStates[variant],
+				spriteDescription.pipelineShaderInfo.pipelineLayout, textureRegistry->GetDescriptorSet(), sprite);
+		}
 }
 
 
 
-int App::LoadTexture(const std::vector<std::string> &filepaths, uint binding)
+uint32_t App::LoadTexture(VulkanUploadBatch &uploads, const std::vector<std::string> &filepaths)
 {
-	assert(binding > 0 && "Binding 0 is reserved for the uniform buffer.");
-	textures[binding - 1].emplace_back(std::make_unique<VulkanTexture>(device, filepaths));
-	return textures[binding - 1].size() - 1;
+	return textureRegistry->LoadTexture(uploads, filepaths);
 }
@@ -1,16 +1,32 @@
 #pragma once
 
 #include "source/vulkan_texture.h"
+#include "draw_queue.h"
+#include "sprite_batch.h"
+#include "thread_pool.h"
 #include "vulkan_descriptors.h"
 #include "vulkan_model.h"
 #include "window.h"
 #include "vulkan_device.h"
+#include "vulkan_frame_context.h"
+#include "vulkan_geometry_arena.h"
+#include "vulkan_gpu_timer.h"
+#include "vulkan_parallel_recorder.h"
 #include "vulkan_pipeline.h"
+#include "vulkan_pipeline_registry.h"
 #include "vulkan_swapchain.h"
+#include "vulkan_texture_registry.h"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstdint>
+#include <future>
+#include <map>
 #include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
 #include <vulkan/vulkan_core.h>
 #include <vector>
 
@@ -20,9 +36,13 @@ class App {
 public:
 	struct VulkanPipelineDescription {
 		ShaderInfo shaderInfo;
-		std::unique_ptr<VulkanPipeline> pipeline;
-		VkPipelineLayout pipelineLayout;
+		// Compiled for the default render state and shaderInfo.specialization.
+		VulkanPipelineRegistry::Handle pipeline;
+		// Pipelines for other render states or constant values, acquired the first time they are asked for.
+		std::map<std::pair<VulkanRenderState, SpecializationConstants>, VulkanPipelineRegistry::Handle> variants;
 		VulkanShaderInfo pipelineShaderInfo;
+		// Critical pipelines are waited for before the first frame, the others are drawn once they are compiled.
+		bool critical = false;
 	};
 
 	struct Object {
@@ -35,12 +55,25 @@ public:
 		std::unique_ptr<VulkanModel> model;
 	};
 
+	// Unit quad, drawn once per sprite instance.
+	struct Quad {
+		std::vector<float> vertices = {
+			-0.5f, -0.5f,  0.0f, 0.0f,
+			 0.5f, -0.5f,  1.0f, 0.0f,
+			 0.5f,  0.5f,  1.0f, 1.0f,
+			-0.5f,  0.5f,  0.0f, 1.0f,
+		};
+		std::vector<uint16_t> indices = {0, 1, 2, 0, 2, 3};
+
+		std::unique_ptr<VulkanModel> model;
+	};
+
 public:
 	uint width, height;
 	uint frame;
 
-	App(const std::string &name, uint width, uint height);
-	~App();
+	// With benchmarkFrames set there is no window, Run() renders that many frames offscreen and reports their times.
+	App(const std::string &name, uint width, uint height, uint32_t benchmarkFrames = 0);
 
 	App(const App &) = delete;
 	App operator=(const App &) = delete;
@@ -51,31 +84,76 @@ public:
 	void Run();
 
 private:
-	void CreateTextureDescriptors();
-
-	void CreatePipelineLayout(VulkanPipelineDescription &pipelineDescription);
+	void RunBenchmark();
 	void RecreateSwapChain();
-	void CreatePipeline(VulkanPipelineDescription &pipelineDescription);
-
-	void CreateCommandBuffers();
-	void FreeCommandBuffers();
+	VulkanPipelineRegistry::Request PipelineRequest(const VulkanPipelineDescription &pipelineDescription,
+		const VulkanRenderState &renderState, const SpecializationConstants &specialization);
+	// Returns a pipeline that can draw with the given render state and constants, all of them, not just the ones
+	// differing from the default. Until a new variant is compiled, the description's pipeline stands in.
+	// Null while neither is ready.
+	VulkanPipeline *GetPipelineVariant(VulkanPipelineDescription &pipelineDescription, const VulkanRenderState &renderState,
+		const SpecializationConstants &specialization);
+	std::map<uint32_t, VulkanDescriptorSetLayout *> ExternalSets();
+	// Acquires new pipelines for shaders that changed on disk, the old ones are drawn until they are compiled.
+	void ReloadShaders();
+
+	void CreateFrameContexts();
 
 	void DrawFrame();
-	void RecordCommandBuffer(int imageIndex);
+	void RecordCommandBuffer(VulkanFrameContext &frame, int imageIndex);
+	void RecordDraws(VkCommandBuffer commandBuffer, size_t begin, size_t end);
+	void QueueTriangles();
+	void FillSpriteBatch();
+	void ReportFrameStats();
+	void ReportPipelineProgress();
 
 	
-	int LoadTexture(const std::vector<std::string> &filepaths, uint binding);
+	// Returns the texture's index in the bindless texture table.
+	uint32_t LoadTexture(VulkanUploadBatch &uploads, const std::vector<std::string> &filepaths);
 
+	// Initialized before the window, the start of the time to first frame.
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
 	Window window;
 	VulkanDevice device;
+	// Per frame work only, so the frame's chunks never queue up behind pipeline compiles.
+	ThreadPool threadPool;
+	// Background pipeline compiles, on at most half the hardware threads.
+	ThreadPool compilePool{std::max(1u, std::thread::hardware_concurrency() / 2)};
+	std::unique_ptr<VulkanParallelRecorder> recorder;
+	DrawQueue drawQueue;
 	std::unique_ptr<VulkanSwapChain> swapChain;
+	std::unique_ptr<VulkanPipelineRegistry> pipelineRegistry;
 	std::vector<VulkanPipelineDescription> pipelineDescriptions;
-	std::vector<VkCommandBuffer> commandBuffers;
-
+	// The render pass the pipelines were created for, unset before the first swap chain.
+	std::optional<VulkanSwapChain::RenderPassKey> pipelineRenderPass;
+	// Non-critical pipelines still compiling, and when they were requested.
+	std::vector<std::shared_future<void>> pendingPipelines;
+	std::chrono::steady_clock::time_point pipelineRequestTime;
+	bool firstFramePresented = false;
+	// One per frame in flight, indexed by the swap chain's current frame.
+	std::vector<std::unique_ptr<VulkanFrameContext>> frameContexts;
+
+	// Holds the vertices and indices of every model below.
+	std::unique_ptr<VulkanGeometryArena> geometryArena;
 	Object triangle;
-
-	std::vector<std::unique_ptr<VulkanTexture>> textures[2];
-	std::unique_ptr<VulkanDescriptorPool> desriptorPool;
-	std::unique_ptr<VulkanDescriptorSetLayout> desriptorSetLayout;
-	std::vector<VkDescriptorSet> descriptorSets;
+	size_t triangleDraws = 4;
+	Quad quad;
+	std::unique_ptr<SpriteBatch> spriteBatch;
+
+	std::unique_ptr<VulkanTextureRegistry> textureRegistry;
+
+	// CPU time spent waiting on the GPU, accumulated over REPORT_FRAMES frames.
+	static constexpr uint32_t REPORT_FRAMES = 600;
+	uint32_t stallFrames = 0;
+	std::chrono::steady_clock::duration stallTotal{};
+	std::chrono::steady_clock::duration stallMax{};
+	// The stall of the current frame alone.
+	std::chrono::steady_clock::duration frameStall{};
+
+	// Frame times in milliseconds of a headless benchmark run. The CPU ones leave out the time spent waiting on the GPU,
+	// the GPU ones are measured with timestamps.
+	uint32_t benchmarkFrames;
+	std::unique_ptr<VulkanGpuTimer> gpuTimer;
+	std::vector<double> cpuFrameTimes;
+	std::vector<double> gpuFrameTimes;
 };
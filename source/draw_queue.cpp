@@ -0,0 +1,241 @@
+#include "draw_queue.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+
+
+namespace {
+	constexpr uint32_t RADIX_BITS = 8;
+	constexpr uint32_t RADIX_SIZE = 1 << RADIX_BITS;
+	constexpr uint32_t RADIX_PASSES = 64 / RADIX_BITS;
+
+	using Histogram = std::array<uint32_t, RADIX_SIZE>;
+
+	uint32_t Digit(uint64_t key, uint32_t pass)
+	{
+		return static_cast<uint32_t>(key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1);
+	}
+}
+
+
+
+uint64_t DrawQueue::MakeKey(uint32_t layer, BlendMode blend, uint32_t pipeline, uint32_t texture, uint32_t model)
+{
+	assert(layer < (1u << LAYER_BITS) && "Layer out of range for the sort key");
+	assert(static_cast<uint32_t>(blend) < (1u << BLEND_BITS) && "Blend mode out of range for the sort key");
+	assert(pipeline < (1u << PIPELINE_BITS) && "Pipeline id out of range for the sort key");
+	assert(texture < (1u << TEXTURE_BITS) && "Texture id out of range for the sort key");
+	assert(model < (1u << MODEL_BITS) && "Model id out of range for the sort key");
+
+	uint64_t key = layer;
+	key = (key << BLEND_BITS) | static_cast<uint32_t>(blend);
+	key = (key << PIPELINE_BITS) | pipeline;
+	key = (key << TEXTURE_BITS) | texture;
+	key = (key << MODEL_BITS) | model;
+	return key;
+}
+
+
+
+DrawQueue::DrawQueue(ThreadPool &threadPool)
+: threadPool{threadPool}
+{
+}
+
+
+
+void DrawQueue::Clear()
+{
+	packets.clear();
+	pushConstants.clear();
+	order.clear();
+	requestedBinds = {};
+	issuedBinds = {};
+}
+
+
+
+void DrawQueue::Add(const DrawPacket &packet, const void *data, uint32_t size)
+{
+	assert(packet.pipeline && packet.model && "Draw packets need a pipeline and a model");
+	assert((!size || packet.shaderInfo) && "Draw packets with push constants need the shader info");
+
+	packets.push_back({packet, static_cast<uint32_t>(pushConstants.size()), size});
+	if(size)
+		pushConstants.insert(pushConstants.end(), static_cast<const char *>(data), static_cast<const char *>(data) + size);
+}
+
+
+
+void DrawQueue::Sort()
+{
+	size_t count = packets.size();
+	order.resize(count);
+	sortScratch.resize(count);
+	for(size_t i = 0; i < count; i++)
+		order[i] = {packets[i].draw.key, static_cast<uint32_t>(i)};
+
+	// Least significant digit first radix sort, which is stable. Every pass, each chunk counts its digits,
+	// the counts give each (digit, chunk) pair its output range, and each chunk scatters into its ranges.
+	size_t chunkCount = std::min<size_t>(threadPool.GetThreadCount() + 1, std::max<size_t>(1, count / MIN_PACKETS_PER_CHUNK));
+	std::vector<Histogram> histograms(chunkCount);
+	for(uint32_t pass = 0; pass < RADIX_PASSES; pass++)
+	{
+		threadPool.ParallelFor(count, chunkCount, [&](size_t chunk, size_t begin, size_t end)
+		{
+			Histogram &histogram = histograms[chunk];
+			histogram.fill(0);
+			for(size_t i = begin; i < end; i++)
+				histogram[Digit(order[i].key, pass)]++;
+		});
+
+		// Most keys share their upper bits, a pass where every key has the same digit would not move anything.
+		bool sorted = false;
+		uint32_t offset = 0;
+		for(uint32_t digit = 0; digit < RADIX_SIZE; digit++)
+		{
+			uint32_t digitCount = 0;
+			for(Histogram &histogram : histograms)
+			{
+				uint32_t chunkDigits = histogram[digit];
+				histogram[digit] = offset + digitCount;
+				digitCount += chunkDigits;
+			}
+			sorted |= digitCount == count;
+			offset += digitCount;
+		}
+		if(sorted)
+			continue;
+
+		threadPool.ParallelFor(count, chunkCount, [&](size_t chunk, size_t begin, size_t end)
+		{
+			Histogram &offsets = histograms[chunk];
+			for(size_t i = begin; i < end; i++)
+				sortScratch[offsets[Digit(order[i].key, pass)]++] = order[i];
+		});
+		order.swap(sortScratch);
+	}
+}
+
+
+
+void DrawQueue::Record(VkCommandBuffer commandBuffer, size_t begin, size_t end)
+{
+	assert(order.size() == packets.size() && "Draw queue must be sorted before recording");
+
+	// Secondary command buffers inherit no state, so every range starts with nothing bound.
+	VulkanPipeline *boundPipeline = nullptr;
+	// Binding a pipeline that bakes a piece of dynamic state invalidates it, so the state is set again whenever
+	// the set of dynamic parts changes.
+	bool boundDynamicRaster = false;
+	bool boundDynamicBlend = false;
+	bool renderStateValid = false;
+	VulkanRenderState boundRenderState;
+	VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+	VkDescriptorSet boundTextureSet = VK_NULL_HANDLE;
+	VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+	VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+	VkIndexType boundIndexType = VK_INDEX_TYPE_UINT32;
+	VkBuffer boundInstanceBuffer = VK_NULL_HANDLE;
+	VkDeviceSize boundInstanceOffset = 0;
+
+	BindCounts requested;
+	BindCounts issued;
+	for(size_t i = begin; i < end && i < order.size(); i++)
+	{
+		const Packet &packet = packets[order[i].packet];
+		const DrawPacket &draw = packet.draw;
+
+		requested.pipelines++;
+		if(draw.pipeline != boundPipeline)
+		{
+			draw.pipeline->Bind(commandBuffer);
+			boundPipeline = draw.pipeline;
+			issued.pipelines++;
+			if(draw.pipeline->HasDynamicRasterState() != boundDynamicRaster
+					|| draw.pipeline->HasDynamicBlendState() != boundDynamicBlend)
+			{
+				boundDynamicRaster = draw.pipeline->HasDynamicRasterState();
+				boundDynamicBlend = draw.pipeline->HasDynamicBlendState();
+				renderStateValid = false;
+			}
+		}
+
+		if(boundDynamicRaster || boundDynamicBlend)
+		{
+			requested.renderStates++;
+			if(!renderStateValid || draw.renderState != boundRenderState)
+			{
+				draw.pipeline->SetDynamicState(commandBuffer, draw.renderState);
+				boundRenderState = draw.renderState;
+				renderStateValid = true;
+				issued.renderStates++;
+			}
+		}
+
+		// Sets bound with a different pipeline layout may be disturbed, so they are bound again.
+		if(draw.textureSet)
+		{
+			requested.descriptorSets++;
+			if(draw.textureSet != boundTextureSet || draw.pipelineLayout != boundLayout)
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.pipelineLayout,
+					1, 1, &draw.textureSet, 0, nullptr);
+				boundTextureSet = draw.textureSet;
+				boundLayout = draw.pipelineLayout;
+				issued.descriptorSets++;
+			}
+		}
+
+		// Models sharing an arena block share the bindings, they only differ in the draw parameters.
+		requested.vertexBuffers++;
+		VkBuffer vertexBuffer = draw.model->GetVertexBuffer();
+		if(vertexBuffer != boundVertexBuffer)
+		{
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &offset);
+			boundVertexBuffer = vertexBuffer;
+			issued.vertexBuffers++;
+		}
+		requested.indexBuffers++;
+		VkBuffer indexBuffer = draw.model->GetIndexBuffer();
+		if(indexBuffer != boundIndexBuffer || draw.model->GetIndexType() != boundIndexType)
+		{
+			vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, draw.model->GetIndexType());
+			boundIndexBuffer = indexBuffer;
+			boundIndexType = draw.model->GetIndexType();
+			issued.indexBuffers++;
+		}
+		if(draw.instanceBuffer)
+		{
+			requested.vertexBuffers++;
+			if(draw.instanceBuffer != boundInstanceBuffer || draw.instanceOffset != boundInstanceOffset)
+			{
+				vkCmdBindVertexBuffers(commandBuffer, 1, 1, &draw.instanceBuffer, &draw.instanceOffset);
+				boundInstanceBuffer = draw.instanceBuffer;
+				boundInstanceOffset = draw.instanceOffset;
+				issued.vertexBuffers++;
+			}
+		}
+
+		if(packet.pushConstantSize)
+			VulkanPipeline::PushConstants(commandBuffer, draw.pipelineLayout, *draw.shaderInfo,
+				pushConstants.data() + packet.pushConstantOffset, packet.pushConstantSize);
+
+		draw.model->Draw(commandBuffer, draw.instanceCount, draw.firstInstance);
+	}
+
+	std::lock_guard<std::mutex> lock(bindCountMutex);
+	requestedBinds.pipelines += requested.pipelines;
+	requestedBinds.vertexBuffers += requested.vertexBuffers;
+	requestedBinds.indexBuffers += requested.indexBuffers;
+	requestedBinds.descriptorSets += requested.descriptorSets;
+	requestedBinds.renderStates += requested.renderStates;
+	issuedBinds.pipelines += issued.pipelines;
+	issuedBinds.vertexBuffers += issued.vertexBuffers;
+	issuedBinds.indexBuffers += issued.indexBuffers;
+	issuedBinds.descriptorSets += issued.descriptorSets;
+	issuedBinds.renderStates += issued.renderStates;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "thread_pool.h"
+#include "vulkan_model.h"
+#include "vulkan_pipeline.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// One draw call and everything it binds.
+struct DrawPacket {
+	// See DrawQueue::MakeKey.
+	uint64_t key = 0;
+
+	VulkanPipeline *pipeline = nullptr;
+	// Set per batch where the pipeline left it dynamic, otherwise the pipeline has to be created for this state.
+	VulkanRenderState renderState;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	// Bound as descriptor set 1, skipped if null.
+	VkDescriptorSet textureSet = VK_NULL_HANDLE;
+	// Its arena blocks are bound as vertex binding 0 and as the index buffer.
+	const VulkanModel *model = nullptr;
+	// Bound as vertex binding 1 if set. Draws sharing one instance buffer should differ in firstInstance, not in the offset.
+	VkBuffer instanceBuffer = VK_NULL_HANDLE;
+	VkDeviceSize instanceOffset = 0;
+	uint32_t instanceCount = 1;
+	uint32_t firstInstance = 0;
+
+	// Only needed by draws with push constants.
+	const VulkanShaderInfo *shaderInfo = nullptr;
+};
+
+// Collects the draws of a frame, sorts them by their keys and records them with as few state changes as possible.
+// Draws with equal keys keep the order they were added in.
+class DrawQueue {
+public:
+	// Number of binds a range of draws asks for, or actually records.
+	struct BindCounts {
+		uint32_t pipelines = 0;
+		uint32_t vertexBuffers = 0;
+		uint32_t indexBuffers = 0;
+		uint32_t descriptorSets = 0;
+		uint32_t renderStates = 0;
+	};
+
+	// Below this many packets per chunk, sorting on several threads costs more than it saves.
+	static constexpr size_t MIN_PACKETS_PER_CHUNK = 4096;
+
+	static constexpr uint32_t LAYER_BITS = 8;
+	static constexpr uint32_t BLEND_BITS = 4;
+	static constexpr uint32_t PIPELINE_BITS = 12;
+	static constexpr uint32_t TEXTURE_BITS = 20;
+	static constexpr uint32_t MODEL_BITS = 20;
+
+	// Packs the sort key, most significant first: layer, blend mode, pipeline, texture, model.
+	// The pipeline, texture and model are small ids chosen by the caller, equal state should get equal ids.
+	static uint64_t MakeKey(uint32_t layer, BlendMode blend, uint32_t pipeline, uint32_t texture, uint32_t model);
+
+	explicit DrawQueue(ThreadPool &threadPool);
+
+	DrawQueue(const DrawQueue &) = delete;
+	DrawQueue &operator=(const DrawQueue &) = delete;
+
+	void Clear();
+	// The push constants are copied, they are pushed from offset 0 right before the draw.
+	void Add(const DrawPacket &packet, const void *pushConstants = nullptr, uint32_t pushConstantSize = 0);
+
+	// Must be called after the last Add and before recording.
+	void Sort();
+	// Records the sorted draws [begin, end). Different ranges may be recorded on different threads.
+	void Record(VkCommandBuffer commandBuffer, size_t begin, size_t end);
+
+	size_t GetDrawCount() const { return packets.size(); }
+	// Binds the recorded draws would have needed without skipping redundant ones, and the binds actually recorded.
+	BindCounts GetRequestedBinds() const { return requestedBinds; }
+	BindCounts GetIssuedBinds() const { return issuedBinds; }
+
+private:
+	struct SortEntry {
+		uint64_t key;
+		uint32_t packet;
+	};
+
+	struct Packet {
+		DrawPacket draw;
+		uint32_t pushConstantOffset;
+		uint32_t pushConstantSize;
+	};
+
+	ThreadPool &threadPool;
+
+	std::vector<Packet> packets;
+	std::vector<char> pushConstants;
+	std::vector<SortEntry> order;
+	std::vector<SortEntry> sortScratch;
+
+	std::mutex bindCountMutex;
+	BindCounts requestedBinds;
+	BindCounts issuedBinds;
+};
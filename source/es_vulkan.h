@@ -2,9 +2,12 @@
 
 #include "vulkan_buffer.h"
 #include "vulkan_descriptors.h"
+#include "specialization_constants.h"
 
-#include <map>
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
@@ -13,34 +16,170 @@ enum class AttributeSize : uint32_t {
 	VECTOR_TWO   = 2,
 	VECTOR_THREE = 3,
 	VECTOR_FOUR  = 4,
+
+	// Compact vertex attribute formats, only valid in attribute and instance layouts. Their input is still
+	// given as floats, VulkanModel packs it on upload. Every format is a multiple of 4 bytes, so attributes stay aligned.
+	HALF_TWO,
+	HALF_FOUR,
+	// [0, 1] and [-1, 1] respectively, stored as 16 bit fixed point.
+	UNORM16_TWO,
+	UNORM16_FOUR,
+	SNORM16_TWO,
+	SNORM16_FOUR,
+	// [0, 1] in 8 bits per channel, four channels packed in 32 bits, for colors.
+	UNORM8_FOUR,
+};
+
+// How the fields of a layout are placed. Vertex and instance layouts are tightly packed in the attribute formats'
+// byte sizes, uniform blocks follow std140 and push constant blocks std430.
+enum class BlockLayout : uint32_t {
+	VERTEX,
+	STD140,
+	STD430,
 };
 
+// Everything is constexpr, so fixed layouts are resolved at compile time and runtime layouts cost a switch per field.
 namespace EsToVulkan {
-    const std::map<AttributeSize, VkFormat> FORMAT_MAP_VULKAN = {
-		{AttributeSize::SIMPLE_FLOAT, VK_FORMAT_R32_SFLOAT},
-		{AttributeSize::VECTOR_TWO, VK_FORMAT_R32G32_SFLOAT},
-		{AttributeSize::VECTOR_THREE, VK_FORMAT_R32G32B32A32_SFLOAT},
-		{AttributeSize::VECTOR_FOUR, VK_FORMAT_R32G32B32A32_SFLOAT},
-	};
-	const std::map<AttributeSize, unsigned long> FORMAT_MAP_SIZE = {
-		{AttributeSize::SIMPLE_FLOAT, 1},
-		{AttributeSize::VECTOR_TWO,   2},
-		{AttributeSize::VECTOR_THREE, 4},
-		{AttributeSize::VECTOR_FOUR,  4},
-	};
-	const std::map<AttributeSize, unsigned long> FORMAT_MAP_TYPE_SIZE = {
-		{AttributeSize::SIMPLE_FLOAT, sizeof(float)},
-		{AttributeSize::VECTOR_TWO,   sizeof(float) * 4},
-		{AttributeSize::VECTOR_THREE, sizeof(float) * 4},
-		{AttributeSize::VECTOR_FOUR,  sizeof(float) * 4},
-	};
+	constexpr bool IsFloatType(AttributeSize size)
+	{
+		return size == AttributeSize::SIMPLE_FLOAT || size == AttributeSize::VECTOR_TWO
+			|| size == AttributeSize::VECTOR_THREE || size == AttributeSize::VECTOR_FOUR;
+	}
+
+	constexpr VkFormat Format(AttributeSize size)
+	{
+		switch(size)
+		{
+			case AttributeSize::SIMPLE_FLOAT: return VK_FORMAT_R32_SFLOAT;
+			case AttributeSize::VECTOR_TWO:   return VK_FORMAT_R32G32_SFLOAT;
+			case AttributeSize::VECTOR_THREE: return VK_FORMAT_R32G32B32_SFLOAT;
+			case AttributeSize::VECTOR_FOUR:  return VK_FORMAT_R32G32B32A32_SFLOAT;
+			case AttributeSize::HALF_TWO:     return VK_FORMAT_R16G16_SFLOAT;
+			case AttributeSize::HALF_FOUR:    return VK_FORMAT_R16G16B16A16_SFLOAT;
+			case AttributeSize::UNORM16_TWO:  return VK_FORMAT_R16G16_UNORM;
+			case AttributeSize::UNORM16_FOUR: return VK_FORMAT_R16G16B16A16_UNORM;
+			case AttributeSize::SNORM16_TWO:  return VK_FORMAT_R16G16_SNORM;
+			case AttributeSize::SNORM16_FOUR: return VK_FORMAT_R16G16B16A16_SNORM;
+			case AttributeSize::UNORM8_FOUR:  return VK_FORMAT_R8G8B8A8_UNORM;
+		}
+		return VK_FORMAT_UNDEFINED;
+	}
+
+	// Number of input floats an attribute takes.
+	constexpr uint32_t ComponentCount(AttributeSize size)
+	{
+		switch(size)
+		{
+			case AttributeSize::SIMPLE_FLOAT:
+				return 1;
+			case AttributeSize::VECTOR_TWO:
+			case AttributeSize::HALF_TWO:
+			case AttributeSize::UNORM16_TWO:
+			case AttributeSize::SNORM16_TWO:
+				return 2;
+			case AttributeSize::VECTOR_THREE:
+				return 3;
+			default:
+				return 4;
+		}
+	}
+
+	// Number of bytes an attribute takes in a vertex buffer.
+	constexpr uint32_t ByteSize(AttributeSize size)
+	{
+		switch(size)
+		{
+			case AttributeSize::HALF_TWO:
+			case AttributeSize::HALF_FOUR:
+			case AttributeSize::UNORM16_TWO:
+			case AttributeSize::UNORM16_FOUR:
+			case AttributeSize::SNORM16_TWO:
+			case AttributeSize::SNORM16_FOUR:
+				return ComponentCount(size) * sizeof(uint16_t);
+			case AttributeSize::UNORM8_FOUR:
+				return ComponentCount(size) * sizeof(uint8_t);
+			default:
+				return ComponentCount(size) * sizeof(float);
+		}
+	}
+
+	// Blocks only hold scalars and vectors, for which std140 and std430 agree: a vec3 is aligned like a vec4
+	// but only 12 bytes long, so a scalar can follow it directly. They differ in the alignment of the block itself.
+	constexpr uint32_t Alignment(AttributeSize size, BlockLayout layout)
+	{
+		if(layout == BlockLayout::VERTEX)
+			return 1;
+		return ComponentCount(size) == 3 ? 16 : ComponentCount(size) * sizeof(float);
+	}
+
+	constexpr uint32_t AlignUp(uint32_t value, uint32_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	constexpr uint32_t FieldOffset(const AttributeSize *fields, size_t index, BlockLayout layout)
+	{
+		uint32_t offset = 0;
+		for(size_t i = 0; i < index; i++)
+			offset = AlignUp(offset, Alignment(fields[i], layout)) + ByteSize(fields[i]);
+		return AlignUp(offset, Alignment(fields[index], layout));
+	}
+
+	// std140 rounds the block up to a multiple of 16 bytes, std430 to its largest member alignment.
+	constexpr uint32_t BlockSize(const AttributeSize *fields, size_t count, BlockLayout layout)
+	{
+		if(!count)
+			return 0;
+
+		uint32_t blockAlignment = layout == BlockLayout::STD140 ? 16 : 1;
+		for(size_t i = 0; i < count; i++)
+			blockAlignment = Alignment(fields[i], layout) > blockAlignment ? Alignment(fields[i], layout) : blockAlignment;
+		return AlignUp(FieldOffset(fields, count - 1, layout) + ByteSize(fields[count - 1]), blockAlignment);
+	}
+
+	inline uint32_t BlockSize(const std::vector<AttributeSize> &fields, BlockLayout layout)
+	{
+		if(layout != BlockLayout::VERTEX)
+			for(AttributeSize field : fields)
+				if(!IsFloatType(field))
+					throw std::runtime_error("compact attribute formats are only valid in vertex layouts!");
+		return BlockSize(fields.data(), fields.size(), layout);
+	}
 }
 
+// A layout known at compile time. Offsets and sizes are constants, so they can be checked against
+// the matching C++ struct and shader block with static_assert.
+template <BlockLayout LAYOUT, AttributeSize... FIELDS>
+struct BlockDescription {
+	static constexpr size_t COUNT = sizeof...(FIELDS);
+	static constexpr AttributeSize FIELD_ARRAY[] = {FIELDS...};
+	static constexpr uint32_t SIZE = EsToVulkan::BlockSize(FIELD_ARRAY, COUNT, LAYOUT);
+
+	template <size_t INDEX>
+	static constexpr uint32_t OFFSET = EsToVulkan::FieldOffset(FIELD_ARRAY, INDEX, LAYOUT);
+	template <size_t INDEX>
+	static constexpr VkFormat FORMAT = EsToVulkan::Format(FIELD_ARRAY[INDEX]);
+
+	static_assert(COUNT > 0, "A block needs at least one field");
+	static_assert(LAYOUT == BlockLayout::VERTEX || (EsToVulkan::IsFloatType(FIELDS) && ...),
+		"Compact attribute formats are only valid in vertex layouts");
+
+	// The runtime form ShaderInfo takes.
+	static std::vector<AttributeSize> Fields() { return {FIELDS...}; }
+};
+
 struct ShaderInfo {
 	std::vector<AttributeSize> attributeLayout;
+	// Optional second vertex binding that advances per instance, its locations follow the attribute layout.
+	std::vector<AttributeSize> instanceLayout;
+	// std140, only float types.
 	std::vector<AttributeSize> uniformLayout;
+	// Small per draw data pushed straight into the command buffer, std430, only float types.
+	std::vector<AttributeSize> pushConstantLayout;
 
 	std::string vertexShaderFilename;
 	std::string fragmentShaderFilename;
 	uint numTextures = 1;
+	// Checked against the constants both shaders declare, the ones left unset keep the shader's default.
+	SpecializationConstants specialization;
 };
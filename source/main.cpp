@@ -1,5 +1,9 @@
+#include <cctype>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <string>
 
 #include "logger.h"
 #include "app.h"
@@ -8,7 +12,24 @@
 
 int main(const int argc, const char ** argv)
 {
-	App app{"Vulkan Tests", 800, 600};
+	// --headless <frames> renders that many frames without a window and reports the frame times.
+	uint32_t benchmarkFrames = 0;
+	for(int i = 1; i < argc; i++)
+		if(strcmp(argv[i], "--headless") == 0)
+		{
+			// strtoul would accept a sign and wrap negative counts around, so only digits are allowed.
+			const char *count = i + 1 < argc ? argv[++i] : "";
+			char *end = nullptr;
+			unsigned long frames = isdigit(static_cast<unsigned char>(count[0])) ? strtoul(count, &end, 10) : 0;
+			if(!frames || *end || frames > UINT32_MAX)
+			{
+				Logger::Error("--headless needs a positive frame count, got \"" + std::string(count) + "\"");
+				return EXIT_FAILURE;
+			}
+			benchmarkFrames = static_cast<uint32_t>(frames);
+		}
+
+	App app{"Vulkan Tests", 800, 600, benchmarkFrames};
 
 	try {
 		app.Run();
@@ -0,0 +1,226 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+
+
+namespace {
+	// Tuning values from Forsyth's article. The simulated cache is an LRU of CACHE_SIZE entries.
+	constexpr uint32_t CACHE_SIZE = 32;
+	constexpr float CACHE_DECAY_POWER = 1.5f;
+	constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+	constexpr float VALENCE_BOOST_SCALE = 2.0f;
+	constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+	constexpr uint32_t NO_TRIANGLE = std::numeric_limits<uint32_t>::max();
+
+
+
+	float VertexScore(int cachePosition, uint32_t remainingTriangles)
+	{
+		if(!remainingTriangles)
+			return -1.0f;
+
+		float score = 0.0f;
+		// The last triangle's vertices get a fixed score, so that the next triangle does not just reuse its edge.
+		if(cachePosition >= 0 && cachePosition < 3)
+			score = LAST_TRIANGLE_SCORE;
+		else if(cachePosition >= 3)
+			score = std::pow(1.0f - static_cast<float>(cachePosition - 3) / (CACHE_SIZE - 3), CACHE_DECAY_POWER);
+
+		// Vertices with few triangles left are finished first, so that they do not linger around as stragglers.
+		return score + VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -VALENCE_BOOST_POWER);
+	}
+
+
+
+	// Hashes and compares vertices by their index into a flat vertex array.
+	struct VertexHash {
+		const float *vertices;
+		uint32_t floatsPerVertex;
+
+		size_t operator()(uint32_t vertex) const
+		{
+			const unsigned char *bytes = reinterpret_cast<const unsigned char *>(vertices + vertex * floatsPerVertex);
+			size_t hash = 14695981039346656037ull;
+			for(size_t i = 0; i < floatsPerVertex * sizeof(float); i++)
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			return hash;
+		}
+	};
+
+	struct VertexEqual {
+		const float *vertices;
+		uint32_t floatsPerVertex;
+
+		bool operator()(uint32_t a, uint32_t b) const
+		{
+			return !memcmp(vertices + a * floatsPerVertex, vertices + b * floatsPerVertex, floatsPerVertex * sizeof(float));
+		}
+	};
+}
+
+
+
+uint32_t MeshOptimizer::DeduplicateVertices(std::vector<float> &vertices, uint32_t floatsPerVertex, std::vector<uint32_t> &indices)
+{
+	uint32_t vertexCount = static_cast<uint32_t>(vertices.size() / floatsPerVertex);
+	std::unordered_map<uint32_t, uint32_t, VertexHash, VertexEqual> unique(vertexCount,
+		VertexHash{vertices.data(), floatsPerVertex}, VertexEqual{vertices.data(), floatsPerVertex});
+
+	std::vector<float> result;
+	result.reserve(vertices.size());
+	std::vector<uint32_t> remap(vertexCount);
+	for(uint32_t vertex = 0; vertex < vertexCount; vertex++)
+	{
+		auto it = unique.emplace(vertex, static_cast<uint32_t>(result.size() / floatsPerVertex));
+		if(it.second)
+			result.insert(result.end(), vertices.begin() + vertex * floatsPerVertex, vertices.begin() + (vertex + 1) * floatsPerVertex);
+		remap[vertex] = it.first->second;
+	}
+
+	for(uint32_t &index : indices)
+		index = remap[index];
+	vertices.swap(result);
+	return static_cast<uint32_t>(vertices.size() / floatsPerVertex);
+}
+
+
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount)
+{
+	assert(indices.size() % 3 == 0 && "Index count must be a multiple of 3");
+	uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+
+	// Triangles using each vertex. Only the first remaining[vertex] entries of a vertex' list are not drawn yet.
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for(uint32_t index : indices)
+		remaining[index]++;
+	std::vector<uint32_t> firstTriangle(vertexCount + 1, 0);
+	for(uint32_t vertex = 0; vertex < vertexCount; vertex++)
+		firstTriangle[vertex + 1] = firstTriangle[vertex] + remaining[vertex];
+	std::vector<uint32_t> vertexTriangles(indices.size());
+	std::vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+	for(uint32_t i = 0; i < indices.size(); i++)
+		vertexTriangles[fill[indices[i]]++] = i / 3;
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for(uint32_t vertex = 0; vertex < vertexCount; vertex++)
+		vertexScore[vertex] = VertexScore(-1, remaining[vertex]);
+
+	std::vector<bool> drawn(triangleCount, false);
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> newCache;
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	uint32_t best = NO_TRIANGLE;
+	uint32_t nextUndrawn = 0;
+	while(result.size() < indices.size())
+	{
+		// Nothing in the cache has triangles left, start over with the next undrawn one.
+		if(best == NO_TRIANGLE)
+		{
+			while(drawn[nextUndrawn])
+				nextUndrawn++;
+			best = nextUndrawn;
+		}
+
+		drawn[best] = true;
+		const uint32_t *triangle = &indices[best * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+
+		newCache.assign(triangle, triangle + 3);
+		for(uint32_t vertex : cache)
+			if(vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+				newCache.push_back(vertex);
+
+		for(int corner = 0; corner < 3; corner++)
+		{
+			uint32_t vertex = triangle[corner];
+			uint32_t *begin = &vertexTriangles[firstTriangle[vertex]];
+			uint32_t *end = begin + remaining[vertex];
+			std::iter_swap(std::find(begin, end, best), end - 1);
+			remaining[vertex]--;
+		}
+
+		// Rescore everything that was in the cache, including what just fell out of it, and pick the best triangle
+		// among the ones those vertices still have.
+		for(size_t i = 0; i < newCache.size(); i++)
+		{
+			uint32_t vertex = newCache[i];
+			cachePosition[vertex] = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+			vertexScore[vertex] = VertexScore(cachePosition[vertex], remaining[vertex]);
+		}
+		best = NO_TRIANGLE;
+		float bestScore = -1.0f;
+		for(uint32_t vertex : newCache)
+			for(uint32_t i = 0; i < remaining[vertex]; i++)
+			{
+				uint32_t candidate = vertexTriangles[firstTriangle[vertex] + i];
+				const uint32_t *corners = &indices[candidate * 3];
+				float score = vertexScore[corners[0]] + vertexScore[corners[1]] + vertexScore[corners[2]];
+				if(score > bestScore)
+				{
+					best = candidate;
+					bestScore = score;
+				}
+			}
+
+		newCache.resize(std::min<size_t>(newCache.size(), CACHE_SIZE));
+		cache.swap(newCache);
+	}
+
+	indices.swap(result);
+}
+
+
+
+uint32_t MeshOptimizer::OptimizeVertexFetch(std::vector<float> &vertices, uint32_t floatsPerVertex, std::vector<uint32_t> &indices)
+{
+	uint32_t vertexCount = static_cast<uint32_t>(vertices.size() / floatsPerVertex);
+	std::vector<uint32_t> remap(vertexCount, std::numeric_limits<uint32_t>::max());
+
+	std::vector<float> result;
+	result.reserve(vertices.size());
+	uint32_t next = 0;
+	for(uint32_t &index : indices)
+	{
+		if(remap[index] == std::numeric_limits<uint32_t>::max())
+		{
+			remap[index] = next++;
+			result.insert(result.end(), vertices.begin() + index * floatsPerVertex, vertices.begin() + (index + 1) * floatsPerVertex);
+		}
+		index = remap[index];
+	}
+
+	vertices.swap(result);
+	return next;
+}
+
+
+
+float MeshOptimizer::ComputeACMR(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+	if(indices.size() < 3)
+		return 0.0f;
+
+	// A vertex is still in the FIFO if fewer than cacheSize other vertices were pushed since it was.
+	std::vector<uint32_t> pushedAt(vertexCount, 0);
+	uint32_t time = cacheSize + 1;
+	uint32_t misses = 0;
+	for(uint32_t index : indices)
+		if(time - pushedAt[index] > cacheSize)
+		{
+			pushedAt[index] = time++;
+			misses++;
+		}
+
+	return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+
+// Load time reordering of indexed triangle lists. Vertices are flat float arrays of floatsPerVertex each.
+namespace MeshOptimizer {
+	// Merges bitwise identical vertices and rewrites the indices to match. Returns the new vertex count.
+	uint32_t DeduplicateVertices(std::vector<float> &vertices, uint32_t floatsPerVertex, std::vector<uint32_t> &indices);
+
+	// Reorders the triangles for the post transform cache, using Tom Forsyth's linear speed vertex cache optimization.
+	void OptimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount);
+
+	// Reorders the vertices by first use, so that vertex fetch walks memory linearly. Unreferenced vertices are dropped.
+	// Returns the new vertex count.
+	uint32_t OptimizeVertexFetch(std::vector<float> &vertices, uint32_t floatsPerVertex, std::vector<uint32_t> &indices);
+
+	// Average cache miss ratio, the transformed vertices per triangle with a FIFO cache of the given size.
+	// 3 is the worst case, 0.5 is about the best a regular grid can get.
+	float ComputeACMR(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize = 16);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+enum class SpecializationType : uint32_t {
+	BOOL,
+	INT,
+	UINT,
+	FLOAT,
+};
+
+// Values for a shader's specialization constants, keyed by their constant_id. A pipeline is compiled per distinct
+// set of values, so a feature switched by a constant is compiled out of the shader instead of branched on.
+// Every value takes 4 bytes, booleans are stored as VkBool32.
+class SpecializationConstants {
+public:
+	struct Constant {
+		uint32_t id;
+		SpecializationType type;
+		uint32_t bits;
+
+		bool operator<(const Constant &other) const
+		{
+			return std::tie(id, type, bits) < std::tie(other.id, other.type, other.bits);
+		}
+		bool operator==(const Constant &other) const { return id == other.id && type == other.type && bits == other.bits; }
+	};
+
+	SpecializationConstants &Set(uint32_t id, bool value) { return Set(id, SpecializationType::BOOL, value ? VK_TRUE : VK_FALSE); }
+	SpecializationConstants &Set(uint32_t id, int32_t value) { return Set(id, SpecializationType::INT, static_cast<uint32_t>(value)); }
+	SpecializationConstants &Set(uint32_t id, uint32_t value) { return Set(id, SpecializationType::UINT, value); }
+	SpecializationConstants &Set(uint32_t id, float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return Set(id, SpecializationType::FLOAT, bits);
+	}
+
+	bool Empty() const { return constants.empty(); }
+	// Sorted by id.
+	const std::vector<Constant> &GetConstants() const { return constants; }
+
+	// Only valid while this object is neither changed nor destroyed.
+	VkSpecializationInfo GetInfo() const
+	{
+		VkSpecializationInfo info{};
+		info.mapEntryCount = static_cast<uint32_t>(entries.size());
+		info.pMapEntries = entries.data();
+		info.dataSize = data.size() * sizeof(uint32_t);
+		info.pData = data.data();
+		return info;
+	}
+
+	bool operator<(const SpecializationConstants &other) const { return constants < other.constants; }
+	bool operator==(const SpecializationConstants &other) const { return constants == other.constants; }
+
+private:
+	SpecializationConstants &Set(uint32_t id, SpecializationType type, uint32_t bits)
+	{
+		size_t i = 0;
+		while(i < constants.size() && constants[i].id < id)
+			i++;
+		if(i < constants.size() && constants[i].id == id)
+			constants[i] = {id, type, bits};
+		else
+			constants.insert(constants.begin() + i, {id, type, bits});
+
+		entries.clear();
+		data.clear();
+		for(const Constant &constant : constants)
+		{
+			entries.push_back({constant.id, static_cast<uint32_t>(data.size() * sizeof(uint32_t)), sizeof(uint32_t)});
+			data.push_back(constant.bits);
+		}
+		return *this;
+	}
+
+	std::vector<Constant> constants;
+	std::vector<VkSpecializationMapEntry> entries;
+	std::vector<uint32_t> data;
+};
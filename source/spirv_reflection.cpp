@@ -0,0 +1,510 @@
+#include "spirv_reflection.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+
+
+namespace {
+	constexpr uint32_t MAGIC = 0x07230203;
+	constexpr uint32_t HEADER_WORDS = 5;
+	constexpr uint32_t NONE = ~0u;
+	// Real shaders nest types a few levels deep. The limit stops a broken module with cyclic types from recursing forever.
+	constexpr uint32_t MAX_TYPE_DEPTH = 64;
+
+	// The subset of the SPIR-V grammar the reflection reads.
+	enum Opcode : uint32_t {
+		OP_ENTRY_POINT = 15,
+		OP_TYPE_BOOL = 20,
+		OP_TYPE_INT = 21,
+		OP_TYPE_FLOAT = 22,
+		OP_TYPE_VECTOR = 23,
+		OP_TYPE_MATRIX = 24,
+		OP_TYPE_IMAGE = 25,
+		OP_TYPE_SAMPLER = 26,
+		OP_TYPE_SAMPLED_IMAGE = 27,
+		OP_TYPE_ARRAY = 28,
+		OP_TYPE_RUNTIME_ARRAY = 29,
+		OP_TYPE_STRUCT = 30,
+		OP_TYPE_POINTER = 32,
+		OP_CONSTANT = 43,
+		OP_SPEC_CONSTANT_TRUE = 48,
+		OP_SPEC_CONSTANT_FALSE = 49,
+		OP_SPEC_CONSTANT = 50,
+		OP_VARIABLE = 59,
+		OP_DECORATE = 71,
+		OP_MEMBER_DECORATE = 72,
+	};
+
+	enum Decoration : uint32_t {
+		DECORATION_SPEC_ID = 1,
+		DECORATION_BUFFER_BLOCK = 3,
+		DECORATION_ARRAY_STRIDE = 6,
+		DECORATION_MATRIX_STRIDE = 7,
+		DECORATION_BUILT_IN = 11,
+		DECORATION_LOCATION = 30,
+		DECORATION_BINDING = 33,
+		DECORATION_DESCRIPTOR_SET = 34,
+		DECORATION_OFFSET = 35,
+	};
+
+	enum StorageClass : uint32_t {
+		STORAGE_UNIFORM_CONSTANT = 0,
+		STORAGE_INPUT = 1,
+		STORAGE_UNIFORM = 2,
+		STORAGE_PUSH_CONSTANT = 9,
+		STORAGE_STORAGE_BUFFER = 12,
+	};
+
+	enum ImageDim : uint32_t {
+		DIM_BUFFER = 5,
+		DIM_SUBPASS_DATA = 6,
+	};
+
+	// Everything known about one result id: the instruction that defined it and its decorations.
+	struct Id {
+		uint32_t opcode = 0;
+		// The words following the result id. Variables and constants store their result type first.
+		std::vector<uint32_t> operands;
+
+		uint32_t specId = NONE;
+		uint32_t location = NONE;
+		uint32_t set = NONE;
+		uint32_t binding = NONE;
+		uint32_t arrayStride = 0;
+		bool bufferBlock = false;
+		bool builtIn = false;
+
+		std::vector<uint32_t> memberOffsets;
+		std::vector<uint32_t> memberMatrixStrides;
+		bool memberBuiltIn = false;
+	};
+
+
+
+	VkShaderStageFlags Stage(uint32_t executionModel)
+	{
+		switch(executionModel)
+		{
+			case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+			case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+			case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+			case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+			case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+			case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		throw std::runtime_error("unsupported shader execution model!");
+	}
+
+
+
+	// Every id read from the module is checked against the id bound.
+	const Id &GetId(const std::vector<Id> &ids, uint32_t index)
+	{
+		if(index >= ids.size())
+			throw std::runtime_error("invalid SPIR-V code!");
+		return ids[index];
+	}
+
+
+
+	// The fewest operands, result id included, an instruction the reflection reads can have.
+	uint32_t MinOperandCount(uint32_t opcode)
+	{
+		switch(opcode)
+		{
+			case OP_TYPE_BOOL:
+			case OP_TYPE_SAMPLER:
+			case OP_TYPE_STRUCT:
+				return 1;
+			case OP_TYPE_FLOAT:
+			case OP_TYPE_SAMPLED_IMAGE:
+			case OP_TYPE_RUNTIME_ARRAY:
+			case OP_SPEC_CONSTANT_TRUE:
+			case OP_SPEC_CONSTANT_FALSE:
+			case OP_DECORATE:
+				return 2;
+			case OP_ENTRY_POINT:
+			case OP_TYPE_INT:
+			case OP_TYPE_VECTOR:
+			case OP_TYPE_MATRIX:
+			case OP_TYPE_ARRAY:
+			case OP_TYPE_POINTER:
+			case OP_CONSTANT:
+			case OP_SPEC_CONSTANT:
+			case OP_VARIABLE:
+			case OP_MEMBER_DECORATE:
+				return 3;
+			case OP_TYPE_IMAGE:
+				return 8;
+		}
+		return 0;
+	}
+
+
+
+	void SetMember(std::vector<uint32_t> &members, uint32_t member, uint32_t value)
+	{
+		if(members.size() <= member)
+			members.resize(member + 1, 0);
+		members[member] = value;
+	}
+
+
+
+	uint32_t ArrayLength(const std::vector<Id> &ids, const Id &array)
+	{
+		const Id &length = GetId(ids, array.operands[1]);
+		if(length.opcode != OP_CONSTANT && length.opcode != OP_SPEC_CONSTANT)
+			throw std::runtime_error("unsupported array length in SPIR-V code!");
+		return length.operands[1];
+	}
+
+
+
+	SpirvReflection::Block ReflectBlock(const std::vector<Id> &ids, uint32_t structType, uint32_t depth = 0);
+
+	uint32_t TypeSize(const std::vector<Id> &ids, uint32_t type, uint32_t matrixStride, uint32_t depth)
+	{
+		if(depth > MAX_TYPE_DEPTH)
+			throw std::runtime_error("unsupported type nesting in SPIR-V code!");
+		const Id &id = GetId(ids, type);
+		switch(id.opcode)
+		{
+			case OP_TYPE_INT:
+			case OP_TYPE_FLOAT:
+				return id.operands[0] / 8;
+			case OP_TYPE_VECTOR:
+				return id.operands[1] * TypeSize(ids, id.operands[0], 0, depth + 1);
+			case OP_TYPE_MATRIX:
+				return id.operands[1] * (matrixStride ? matrixStride : TypeSize(ids, id.operands[0], 0, depth + 1));
+			case OP_TYPE_ARRAY:
+				return ArrayLength(ids, id) * (id.arrayStride ? id.arrayStride
+					: TypeSize(ids, id.operands[0], matrixStride, depth + 1));
+			case OP_TYPE_STRUCT:
+				return ReflectBlock(ids, type, depth + 1).size;
+			default:
+				// Runtime arrays take whatever is left of the buffer.
+				return 0;
+		}
+	}
+
+
+
+	SpirvReflection::Block ReflectBlock(const std::vector<Id> &ids, uint32_t structType, uint32_t depth)
+	{
+		const Id &id = GetId(ids, structType);
+		SpirvReflection::Block block;
+		for(uint32_t member = 0; member < id.operands.size(); member++)
+		{
+			uint32_t offset = member < id.memberOffsets.size() ? id.memberOffsets[member] : 0;
+			uint32_t matrixStride = member < id.memberMatrixStrides.size() ? id.memberMatrixStrides[member] : 0;
+			block.memberOffsets.push_back(offset);
+			block.size = std::max(block.size, offset + TypeSize(ids, id.operands[member], matrixStride, depth));
+		}
+		return block;
+	}
+
+
+
+	VkFormat InputFormat(const std::vector<Id> &ids, uint32_t componentType, uint32_t componentCount)
+	{
+		static const VkFormat FLOAT_FORMATS[] = {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+			VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+		static const VkFormat INT_FORMATS[] = {VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT,
+			VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT};
+		static const VkFormat UINT_FORMATS[] = {VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT,
+			VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT};
+
+		const Id &id = GetId(ids, componentType);
+		if((id.opcode != OP_TYPE_FLOAT && id.opcode != OP_TYPE_INT) || id.operands[0] != 32 || !componentCount
+				|| componentCount > 4)
+			throw std::runtime_error("unsupported vertex input type!");
+		if(id.opcode == OP_TYPE_FLOAT)
+			return FLOAT_FORMATS[componentCount - 1];
+		return id.operands[1] ? INT_FORMATS[componentCount - 1] : UINT_FORMATS[componentCount - 1];
+	}
+
+
+
+	SpecializationType ConstantType(const Id &type)
+	{
+		if(type.opcode == OP_TYPE_BOOL)
+			return SpecializationType::BOOL;
+		if(type.opcode == OP_TYPE_INT && type.operands[0] == 32)
+			return type.operands[1] ? SpecializationType::INT : SpecializationType::UINT;
+		if(type.opcode == OP_TYPE_FLOAT && type.operands[0] == 32)
+			return SpecializationType::FLOAT;
+		throw std::runtime_error("unsupported specialization constant type!");
+	}
+
+
+
+	VkDescriptorType DescriptorType(const Id &type, uint32_t storageClass)
+	{
+		if(storageClass == STORAGE_STORAGE_BUFFER || (storageClass == STORAGE_UNIFORM && type.bufferBlock))
+			return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		if(storageClass == STORAGE_UNIFORM)
+			return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+		switch(type.opcode)
+		{
+			case OP_TYPE_SAMPLER:
+				return VK_DESCRIPTOR_TYPE_SAMPLER;
+			case OP_TYPE_SAMPLED_IMAGE:
+				return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			case OP_TYPE_IMAGE:
+			{
+				// Sampled is 1 for images used with a sampler and 2 for storage images.
+				uint32_t dim = type.operands[1];
+				bool storage = type.operands[5] == 2;
+				if(dim == DIM_SUBPASS_DATA)
+					return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+				if(dim == DIM_BUFFER)
+					return storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+				return storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			}
+		}
+		throw std::runtime_error("unsupported descriptor type in SPIR-V code!");
+	}
+}
+
+
+
+SpirvReflection::SpirvReflection(const std::vector<char> &code)
+{
+	const uint32_t *words = reinterpret_cast<const uint32_t *>(code.data());
+	size_t wordCount = code.size() / sizeof(uint32_t);
+	// Compilers number ids densely, a bound beyond the size of the module comes from a broken header.
+	if(code.size() % sizeof(uint32_t) || wordCount < HEADER_WORDS || words[0] != MAGIC || words[3] > wordCount)
+		throw std::runtime_error("invalid SPIR-V code!");
+
+	std::vector<Id> ids(words[3]);
+	std::vector<uint32_t> variables;
+	std::vector<uint32_t> constants;
+	auto id = [&ids](uint32_t index) -> Id &
+	{
+		if(index >= ids.size())
+			throw std::runtime_error("invalid SPIR-V code!");
+		return ids[index];
+	};
+	// Every result id is defined exactly once.
+	auto define = [&id](uint32_t index, uint32_t opcode) -> Id &
+	{
+		Id &result = id(index);
+		if(result.opcode)
+			throw std::runtime_error("invalid SPIR-V code!");
+		result.opcode = opcode;
+		return result;
+	};
+
+	for(size_t i = HEADER_WORDS; i < wordCount; )
+	{
+		uint32_t opcode = words[i] & 0xFFFF;
+		uint32_t length = words[i] >> 16;
+		if(!length || i + length > wordCount)
+			throw std::runtime_error("invalid SPIR-V code!");
+		const uint32_t *operands = words + i + 1;
+		uint32_t operandCount = length - 1;
+		i += length;
+		if(operandCount < MinOperandCount(opcode))
+			throw std::runtime_error("invalid SPIR-V code!");
+
+		switch(opcode)
+		{
+			case OP_ENTRY_POINT:
+				stages |= Stage(operands[0]);
+				break;
+			case OP_TYPE_BOOL:
+			case OP_TYPE_INT:
+			case OP_TYPE_FLOAT:
+			case OP_TYPE_VECTOR:
+			case OP_TYPE_MATRIX:
+			case OP_TYPE_IMAGE:
+			case OP_TYPE_SAMPLER:
+			case OP_TYPE_SAMPLED_IMAGE:
+			case OP_TYPE_ARRAY:
+			case OP_TYPE_RUNTIME_ARRAY:
+			case OP_TYPE_STRUCT:
+			case OP_TYPE_POINTER:
+				define(operands[0], opcode).operands.assign(operands + 1, operands + operandCount);
+				break;
+			case OP_CONSTANT:
+			case OP_SPEC_CONSTANT:
+			case OP_VARIABLE:
+				define(operands[1], opcode).operands = {operands[0], operands[2]};
+				if(opcode == OP_VARIABLE)
+					variables.push_back(operands[1]);
+				if(opcode == OP_SPEC_CONSTANT)
+					constants.push_back(operands[1]);
+				break;
+			case OP_SPEC_CONSTANT_TRUE:
+			case OP_SPEC_CONSTANT_FALSE:
+				define(operands[1], opcode).operands = {operands[0], opcode == OP_SPEC_CONSTANT_TRUE ? VK_TRUE : VK_FALSE};
+				constants.push_back(operands[1]);
+				break;
+			case OP_DECORATE:
+			{
+				Id &target = id(operands[0]);
+				uint32_t value = operandCount > 2 ? operands[2] : 0;
+				switch(operands[1])
+				{
+					case DECORATION_SPEC_ID: target.specId = value; break;
+					case DECORATION_BUFFER_BLOCK: target.bufferBlock = true; break;
+					case DECORATION_ARRAY_STRIDE: target.arrayStride = value; break;
+					case DECORATION_BUILT_IN: target.builtIn = true; break;
+					case DECORATION_LOCATION: target.location = value; break;
+					case DECORATION_BINDING: target.binding = value; break;
+					case DECORATION_DESCRIPTOR_SET: target.set = value; break;
+				}
+				break;
+			}
+			case OP_MEMBER_DECORATE:
+			{
+				Id &target = id(operands[0]);
+				uint32_t value = operandCount > 3 ? operands[3] : 0;
+				// A struct cannot have more members than the module has words.
+				if(operands[1] >= wordCount)
+					throw std::runtime_error("invalid SPIR-V code!");
+				if(operands[2] == DECORATION_OFFSET)
+					SetMember(target.memberOffsets, operands[1], value);
+				else if(operands[2] == DECORATION_MATRIX_STRIDE)
+					SetMember(target.memberMatrixStrides, operands[1], value);
+				else if(operands[2] == DECORATION_BUILT_IN)
+					target.memberBuiltIn = true;
+				break;
+			}
+		}
+	}
+
+	for(uint32_t variableId : variables)
+	{
+		const Id &variable = id(variableId);
+		uint32_t storageClass = variable.operands[1];
+		const Id &pointer = id(variable.operands[0]);
+		if(pointer.opcode != OP_TYPE_POINTER)
+			throw std::runtime_error("invalid SPIR-V code!");
+		uint32_t typeId = pointer.operands[1];
+
+		if(storageClass == STORAGE_INPUT)
+		{
+			const Id &type = id(typeId);
+			if(!(stages & VK_SHADER_STAGE_VERTEX_BIT) || variable.builtIn || type.memberBuiltIn)
+				continue;
+			if(type.opcode == OP_TYPE_VECTOR)
+				inputs.push_back({variable.location, type.operands[1], InputFormat(ids, type.operands[0], type.operands[1])});
+			else
+				inputs.push_back({variable.location, 1, InputFormat(ids, typeId, 1)});
+		}
+		else if(storageClass == STORAGE_PUSH_CONSTANT)
+		{
+			pushConstants = ReflectBlock(ids, typeId);
+			pushConstantStages = stages;
+		}
+		else if(storageClass == STORAGE_UNIFORM_CONSTANT || storageClass == STORAGE_UNIFORM || storageClass == STORAGE_STORAGE_BUFFER)
+		{
+			// Arrays of resources become a descriptor count, runtime sized ones a count of zero.
+			uint32_t count = 1;
+			for(uint32_t depth = 0; id(typeId).opcode == OP_TYPE_ARRAY || id(typeId).opcode == OP_TYPE_RUNTIME_ARRAY; depth++)
+			{
+				if(depth > MAX_TYPE_DEPTH)
+					throw std::runtime_error("unsupported type nesting in SPIR-V code!");
+				count = id(typeId).opcode == OP_TYPE_ARRAY ? count * ArrayLength(ids, id(typeId)) : 0;
+				typeId = id(typeId).operands[0];
+			}
+
+			const Id &type = id(typeId);
+			Binding binding{};
+			binding.set = variable.set == NONE ? 0 : variable.set;
+			binding.binding = variable.binding == NONE ? 0 : variable.binding;
+			binding.type = DescriptorType(type, storageClass);
+			binding.count = count;
+			binding.stages = stages;
+			if(type.opcode == OP_TYPE_STRUCT)
+				binding.block = ReflectBlock(ids, typeId);
+			bindings.push_back(binding);
+		}
+	}
+
+	// Constants without a SpecId are derived from other constants and cannot be set.
+	for(uint32_t constantId : constants)
+	{
+		const Id &constant = id(constantId);
+		if(constant.specId != NONE)
+			specializationConstants.push_back({constant.specId, ConstantType(id(constant.operands[0])), constant.operands[1]});
+	}
+
+	std::sort(inputs.begin(), inputs.end(), [](const Input &a, const Input &b) { return a.location < b.location; });
+	std::sort(specializationConstants.begin(), specializationConstants.end());
+	std::sort(bindings.begin(), bindings.end(), [](const Binding &a, const Binding &b)
+		{ return std::tie(a.set, a.binding) < std::tie(b.set, b.binding); });
+}
+
+
+
+void SpirvReflection::Merge(const SpirvReflection &other)
+{
+	stages |= other.stages;
+	if(!other.inputs.empty())
+		inputs = other.inputs;
+
+	for(const Binding &binding : other.bindings)
+	{
+		auto it = std::find_if(bindings.begin(), bindings.end(), [&binding](const Binding &existing)
+			{ return existing.set == binding.set && existing.binding == binding.binding; });
+		if(it == bindings.end())
+			bindings.push_back(binding);
+		else if(it->type != binding.type || it->count != binding.count)
+			throw std::runtime_error("shader stages disagree on descriptor set " + std::to_string(binding.set)
+				+ " binding " + std::to_string(binding.binding) + "!");
+		else
+			it->stages |= binding.stages;
+	}
+	std::sort(bindings.begin(), bindings.end(), [](const Binding &a, const Binding &b)
+		{ return std::tie(a.set, a.binding) < std::tie(b.set, b.binding); });
+
+	for(const SpecializationConstants::Constant &constant : other.specializationConstants)
+	{
+		auto it = std::find_if(specializationConstants.begin(), specializationConstants.end(),
+			[&constant](const SpecializationConstants::Constant &existing) { return existing.id == constant.id; });
+		if(it == specializationConstants.end())
+			specializationConstants.push_back(constant);
+		else if(it->type != constant.type)
+			throw std::runtime_error("shader stages disagree on specialization constant " + std::to_string(constant.id) + "!");
+	}
+	std::sort(specializationConstants.begin(), specializationConstants.end());
+
+	// Stages may declare only a prefix of the block, the pipeline needs the longest one.
+	if(other.pushConstants.size > pushConstants.size)
+		pushConstants = other.pushConstants;
+	pushConstantStages |= other.pushConstantStages;
+}
+
+
+
+bool SpirvReflection::SameInterface(const SpirvReflection &other) const
+{
+	auto sameBlock = [](const Block &a, const Block &b)
+		{ return a.size == b.size && a.memberOffsets == b.memberOffsets; };
+	auto sameInput = [](const Input &a, const Input &b)
+		{ return a.location == b.location && a.componentCount == b.componentCount && a.format == b.format; };
+	auto sameBinding = [&sameBlock](const Binding &a, const Binding &b)
+	{
+		return std::tie(a.set, a.binding, a.type, a.count, a.stages) == std::tie(b.set, b.binding, b.type, b.count, b.stages)
+			&& sameBlock(a.block, b.block);
+	};
+
+	return stages == other.stages && pushConstantStages == other.pushConstantStages
+		&& sameBlock(pushConstants, other.pushConstants)
+		&& std::equal(inputs.begin(), inputs.end(), other.inputs.begin(), other.inputs.end(), sameInput)
+		&& std::equal(bindings.begin(), bindings.end(), other.bindings.begin(), other.bindings.end(), sameBinding);
+}
+
+
+
+uint32_t SpirvReflection::GetSetCount() const
+{
+	return bindings.empty() ? 0 : bindings.back().set + 1;
+}
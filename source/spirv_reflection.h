@@ -0,0 +1,68 @@
+#pragma once
+
+#include "specialization_constants.h"
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// The interface of a shader as declared in its SPIR-V: vertex inputs, descriptor bindings, specialization constants
+// and the push constant block.
+// Only the handful of instructions needed for that are parsed, everything else is skipped.
+class SpirvReflection {
+public:
+	struct Block {
+		// End of the last member, the number of bytes the shader can read. Zero if there is no block.
+		uint32_t size = 0;
+		std::vector<uint32_t> memberOffsets;
+	};
+
+	struct Input {
+		uint32_t location;
+		// The shader side type. The vertex buffer may still store the attribute in a compact format.
+		uint32_t componentCount;
+		VkFormat format;
+	};
+
+	struct Binding {
+		uint32_t set;
+		uint32_t binding;
+		VkDescriptorType type;
+		// Zero for runtime sized arrays.
+		uint32_t count;
+		VkShaderStageFlags stages;
+		// Only filled in for uniform and storage buffers.
+		Block block;
+	};
+
+	SpirvReflection() = default;
+	// The raw contents of a .spv file. Throws if it is not a SPIR-V module.
+	explicit SpirvReflection(const std::vector<char> &code);
+
+	// Adds the interface of another stage of the same pipeline. Resources used by both get both stage flags.
+	void Merge(const SpirvReflection &other);
+	// True if both declare the same inputs, bindings and block layouts, so one can replace the other in a pipeline layout.
+	bool SameInterface(const SpirvReflection &other) const;
+
+	VkShaderStageFlags GetStages() const { return stages; }
+	// Vertex stage only, sorted by location.
+	const std::vector<Input> &GetInputs() const { return inputs; }
+	// Sorted by set, then binding.
+	const std::vector<Binding> &GetBindings() const { return bindings; }
+	// Their bits hold the default values, sorted by id.
+	const std::vector<SpecializationConstants::Constant> &GetSpecializationConstants() const { return specializationConstants; }
+	const Block &GetPushConstants() const { return pushConstants; }
+	VkShaderStageFlags GetPushConstantStages() const { return pushConstantStages; }
+	// One more than the highest set used, pipeline layouts need a set layout for every set below it.
+	uint32_t GetSetCount() const;
+
+private:
+	VkShaderStageFlags stages = 0;
+	std::vector<Input> inputs;
+	std::vector<Binding> bindings;
+	std::vector<SpecializationConstants::Constant> specializationConstants;
+	Block pushConstants;
+	VkShaderStageFlags pushConstantStages = 0;
+};
@@ -0,0 +1,76 @@
+#include "sprite_batch.h"
+
+#include <cstddef>
+#include <cstring>
+
+
+
+static_assert(SpriteBatch::InstanceLayout::OFFSET<1> == offsetof(SpriteInstance, scale), "sprite scale offset mismatch");
+static_assert(SpriteBatch::InstanceLayout::OFFSET<2> == offsetof(SpriteInstance, rotation), "sprite rotation offset mismatch");
+static_assert(SpriteBatch::InstanceLayout::OFFSET<3> == offsetof(SpriteInstance, color), "sprite color offset mismatch");
+static_assert(SpriteBatch::InstanceLayout::SIZE == sizeof(SpriteInstance), "sprite instance size mismatch");
+
+
+
+SpriteBatch::SpriteBatch(const VulkanModel &quad)
+: quad{quad}
+{
+}
+
+
+
+void SpriteBatch::Clear()
+{
+	draws.clear();
+	drawIndex.clear();
+	instanceCount = 0;
+}
+
+
+
+void SpriteBatch::Add(uint64_t key, VulkanPipeline &pipeline, const VulkanRenderState &renderState, VkPipelineLayout pipelineLayout,
+	VkDescriptorSet textureSet, const SpriteInstance &instance)
+{
+	auto drawKey = std::make_tuple(key, &pipeline, renderState, textureSet);
+	auto it = drawIndex.find(drawKey);
+	if(it == drawIndex.end())
+	{
+		it = drawIndex.emplace(drawKey, draws.size()).first;
+		draws.push_back({key, &pipeline, renderState, pipelineLayout, textureSet, {}});
+	}
+
+	draws[it->second].instances.push_back(instance);
+	instanceCount++;
+}
+
+
+
+void SpriteBatch::Queue(VulkanFrameContext &frame, DrawQueue &queue)
+{
+	if(!instanceCount)
+		return;
+
+	// One scratch allocation for the whole batch, every draw gets a slice of it.
+	VulkanStagingRegion region = frame.AllocateScratch(instanceCount * sizeof(SpriteInstance), alignof(SpriteInstance));
+	uint32_t firstInstance = 0;
+	for(const Draw &draw : draws)
+	{
+		memcpy(static_cast<SpriteInstance *>(region.data) + firstInstance, draw.instances.data(),
+			draw.instances.size() * sizeof(SpriteInstance));
+
+		DrawPacket packet;
+		packet.key = draw.key;
+		packet.pipeline = draw.pipeline;
+		packet.renderState = draw.renderState;
+		packet.pipelineLayout = draw.pipelineLayout;
+		packet.textureSet = draw.textureSet;
+		packet.model = &quad;
+		packet.instanceBuffer = region.buffer;
+		packet.instanceOffset = region.offset;
+		packet.instanceCount = static_cast<uint32_t>(draw.instances.size());
+		packet.firstInstance = firstInstance;
+		queue.Add(packet);
+
+		firstInstance += packet.instanceCount;
+	}
+}
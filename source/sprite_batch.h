@@ -0,0 +1,72 @@
+#pragma once
+
+#include "draw_queue.h"
+#include "es_vulkan.h"
+#include "vulkan_frame_context.h"
+#include "vulkan_model.h"
+#include "vulkan_pipeline.h"
+
+#include <cstddef>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Per instance data of a sprite, laid out as described by SpriteBatch::InstanceLayout.
+struct SpriteInstance {
+	float offset[2];
+	float scale[2];
+	float rotation;
+	float layer;
+	// Index into the bindless texture table.
+	float texture;
+	float padding;
+	float color[4];
+};
+
+// Collects sprites for one frame and draws all sprites sharing a pipeline, render state and texture with a single instanced draw
+// of a shared quad. The instance data of all draws lives in one scratch allocation of the frame context, so the
+// draws only differ in their first instance and share a single instance buffer binding.
+class SpriteBatch {
+public:
+	// The instance layout sprite pipelines must be created with, matches SpriteInstance.
+	// Its fields are offset, scale, (rotation, texture layer, texture index, padding) and color.
+	using InstanceLayout = BlockDescription<BlockLayout::VERTEX,
+		AttributeSize::VECTOR_TWO, AttributeSize::VECTOR_TWO, AttributeSize::VECTOR_FOUR, AttributeSize::VECTOR_FOUR>;
+	// constant_id of the sprite shader's bool that multiplies the texture by the instance color.
+	static constexpr uint32_t TINT_CONSTANT = 0;
+
+	explicit SpriteBatch(const VulkanModel &quad);
+
+	SpriteBatch(const SpriteBatch &) = delete;
+	SpriteBatch &operator=(const SpriteBatch &) = delete;
+
+	void Clear();
+	// The texture set is bound as descriptor set 1 of the given pipeline layout.
+	// Only sprites with equal sort keys share a draw, so batching keeps the order the keys give.
+	void Add(uint64_t key, VulkanPipeline &pipeline, const VulkanRenderState &renderState, VkPipelineLayout pipelineLayout,
+		VkDescriptorSet textureSet, const SpriteInstance &instance);
+
+	// Copies the instances of every draw into the frame's scratch memory and adds the draws to the queue.
+	void Queue(VulkanFrameContext &frame, DrawQueue &queue);
+
+	size_t GetDrawCount() const { return draws.size(); }
+	size_t GetInstanceCount() const { return instanceCount; }
+
+private:
+	struct Draw {
+		uint64_t key;
+		VulkanPipeline *pipeline;
+		VulkanRenderState renderState;
+		VkPipelineLayout pipelineLayout;
+		VkDescriptorSet textureSet;
+		std::vector<SpriteInstance> instances;
+	};
+
+	const VulkanModel &quad;
+	std::vector<Draw> draws;
+	std::map<std::tuple<uint64_t, VulkanPipeline *, VulkanRenderState, VkDescriptorSet>, size_t> drawIndex;
+	size_t instanceCount = 0;
+};
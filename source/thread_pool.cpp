@@ -0,0 +1,96 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <exception>
+
+
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+	if(!threadCount)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for(unsigned i = 0; i < threadCount; i++)
+		threads.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+	for(auto &thread : threads)
+		thread.join();
+}
+
+
+
+std::future<void> ThreadPool::Run(std::function<void()> job)
+{
+	std::packaged_task<void()> task(std::move(job));
+	std::future<void> result = task.get_future();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.emplace_back(std::move(task));
+	}
+	condition.notify_one();
+	return result;
+}
+
+
+
+void ThreadPool::ParallelFor(size_t count, size_t chunkCount, const std::function<void(size_t chunk, size_t begin, size_t end)> &job)
+{
+	chunkCount = std::min(std::max<size_t>(chunkCount, 1), std::max<size_t>(count, 1));
+	size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+	// The calling thread would only wait anyway, so it takes the first chunk itself.
+	std::vector<std::future<void>> results;
+	for(size_t chunk = 1; chunk < chunkCount; chunk++)
+	{
+		size_t begin = std::min(count, chunk * chunkSize);
+		size_t end = std::min(count, begin + chunkSize);
+		results.push_back(Run([&job, chunk, begin, end] { job(chunk, begin, end); }));
+	}
+	// The queued chunks reference job and the caller's stack, so all of them have to finish before anything is thrown.
+	std::exception_ptr error;
+	try
+	{
+		job(0, 0, std::min(count, chunkSize));
+	}
+	catch(...)
+	{
+		error = std::current_exception();
+	}
+	for(auto &result : results)
+		result.wait();
+	if(error)
+		std::rethrow_exception(error);
+
+	// get() rethrows exceptions from the workers.
+	for(auto &result : results)
+		result.get();
+}
+
+
+
+void ThreadPool::WorkerLoop()
+{
+	while(true)
+	{
+		std::packaged_task<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if(stopping && jobs.empty())
+				return;
+			task = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		task();
+	}
+}
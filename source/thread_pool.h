@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+// Fixed set of worker threads pulling jobs from a shared queue.
+class ThreadPool {
+public:
+	// A thread count of zero uses one thread per hardware thread.
+	explicit ThreadPool(unsigned threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	std::future<void> Run(std::function<void()> job);
+	// Splits [0, count) into at most chunkCount contiguous ranges and blocks until all of them ran.
+	// The chunk index is passed along, so callers can keep per chunk state without locking.
+	void ParallelFor(size_t count, size_t chunkCount, const std::function<void(size_t chunk, size_t begin, size_t end)> &job);
+
+	unsigned GetThreadCount() const { return static_cast<unsigned>(threads.size()); }
+
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread> threads;
+	std::deque<std::packaged_task<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+};
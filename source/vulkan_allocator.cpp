@@ -0,0 +1,329 @@
+#include "vulkan_allocator.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+
+
+namespace {
+	const VkDeviceSize LARGE_HEAP_BLOCK_SIZE = 64ull * 1024 * 1024;
+	const VkDeviceSize SMALL_HEAP_LIMIT = 1024ull * 1024 * 1024;
+
+	VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+
+
+	VkDeviceSize AlignDown(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return value / alignment * alignment;
+	}
+}
+
+
+
+VulkanAllocator::VulkanAllocator(VkDevice device, VkPhysicalDevice physicalDevice)
+: device{device}
+{
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+
+	for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		pools.push_back({i, false, {}});
+		pools.push_back({i, true, {}});
+	}
+}
+
+
+
+VulkanAllocator::~VulkanAllocator()
+{
+	for(auto &pool : pools)
+		for(auto &block : pool.blocks)
+		{
+			if(block->allocationCount)
+				Logger::Warning("Destroying memory block with " + std::to_string(block->allocationCount) + " live allocations.");
+			DestroyBlock(*block);
+		}
+}
+
+
+
+VulkanAllocation VulkanAllocator::Allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool optimalTiling)
+{
+	uint32_t memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
+	bool hostVisible = memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+	// Host visible ranges are padded to the atom size, so that flushing one allocation never touches its neighbours.
+	VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+	VkDeviceSize size = requirements.size;
+	if(hostVisible)
+	{
+		alignment = std::max(alignment, nonCoherentAtomSize);
+		size = AlignUp(size, nonCoherentAtomSize);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t poolIndex = memoryType * 2 + (optimalTiling ? 1 : 0);
+	Pool &pool = pools[poolIndex];
+	VkDeviceSize blockSize = PreferredBlockSize(memoryType);
+
+	VulkanMemoryBlock *target = nullptr;
+	VkDeviceSize offset = 0;
+	if(size > blockSize / 2)
+	{
+		target = CreateBlock(poolIndex, size, true);
+		TryAllocate(*target, size, alignment, offset);
+	}
+	else
+	{
+		for(auto &block : pool.blocks)
+			if(!block->dedicated && TryAllocate(*block, size, alignment, offset))
+			{
+				target = block.get();
+				break;
+			}
+		if(!target)
+		{
+			target = CreateBlock(poolIndex, blockSize, false);
+			if(!TryAllocate(*target, size, alignment, offset))
+				throw std::runtime_error("failed to sub-allocate from a fresh memory block!");
+		}
+	}
+
+	VulkanAllocation allocation;
+	allocation.memory = target->memory;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.mapped = target->mapped ? static_cast<char *>(target->mapped) + offset : nullptr;
+	allocation.memoryType = memoryType;
+	allocation.block = target;
+	return allocation;
+}
+
+
+
+void VulkanAllocator::Free(VulkanAllocation &allocation)
+{
+	if(!allocation.block)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	VulkanMemoryBlock *block = allocation.block;
+	Release(*block, allocation.offset, allocation.size);
+	allocation = VulkanAllocation{};
+
+	if(block->allocationCount)
+		return;
+
+	// Keep one empty block around per pool, so that a pool does not thrash between one and zero blocks.
+	Pool &pool = pools[block->pool];
+	size_t emptyBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(),
+		[](const std::unique_ptr<VulkanMemoryBlock> &it) { return !it->dedicated && !it->allocationCount; });
+	if(block->dedicated || emptyBlocks > 1)
+	{
+		DestroyBlock(*block);
+		pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(),
+			[block](const std::unique_ptr<VulkanMemoryBlock> &it) { return it.get() == block; }));
+	}
+}
+
+
+
+uint32_t VulkanAllocator::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+		if((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+
+
+VkMappedMemoryRange VulkanAllocator::MappedRange(const VulkanAllocation &allocation, VkDeviceSize size, VkDeviceSize offset) const
+{
+	VkDeviceSize begin = allocation.offset + offset;
+	VkDeviceSize end = allocation.offset + (size == VK_WHOLE_SIZE ? allocation.size : offset + size);
+	VkDeviceSize blockEnd = allocation.block ? allocation.block->size : allocation.offset + allocation.size;
+
+	VkMappedMemoryRange mappedRange = {};
+	mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	mappedRange.memory = allocation.memory;
+	mappedRange.offset = AlignDown(begin, nonCoherentAtomSize);
+	end = AlignUp(end, nonCoherentAtomSize);
+	mappedRange.size = end >= blockEnd ? VK_WHOLE_SIZE : end - mappedRange.offset;
+	return mappedRange;
+}
+
+
+
+std::vector<VulkanHeapStats> VulkanAllocator::GetHeapStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::vector<VulkanHeapStats> stats(memoryProperties.memoryHeapCount);
+	for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+	{
+		stats[i].heapIndex = i;
+		stats[i].heapSize = memoryProperties.memoryHeaps[i].size;
+	}
+
+	for(const auto &pool : pools)
+	{
+		VulkanHeapStats &heap = stats[memoryProperties.memoryTypes[pool.memoryType].heapIndex];
+		for(const auto &block : pool.blocks)
+		{
+			heap.blockCount++;
+			heap.allocationCount += block->allocationCount;
+			heap.blockBytes += block->size;
+			heap.usedBytes += block->usedBytes;
+			heap.freeRangeCount += block->freeRanges.size();
+			for(const auto &range : block->freeRanges)
+				heap.largestFreeRange = std::max(heap.largestFreeRange, range.size);
+		}
+	}
+
+	return stats;
+}
+
+
+
+void VulkanAllocator::LogStats() const
+{
+	for(const auto &heap : GetHeapStats())
+	{
+		if(!heap.blockCount)
+			continue;
+
+		VkDeviceSize freeBytes = heap.blockBytes - heap.usedBytes;
+		// 0% means all free memory is one contiguous range, values close to 100% mean it is scattered in small holes.
+		unsigned fragmentation = freeBytes ? static_cast<unsigned>(100 - heap.largestFreeRange * 100 / freeBytes) : 0;
+		Logger::Status("Heap " + std::to_string(heap.heapIndex) + ": "
+			+ std::to_string(heap.allocationCount) + " allocations in "
+			+ std::to_string(heap.blockCount) + " blocks, "
+			+ std::to_string(heap.usedBytes / 1024) + " / " + std::to_string(heap.blockBytes / 1024) + " KiB used, "
+			+ std::to_string(heap.freeRangeCount) + " free ranges, "
+			+ std::to_string(fragmentation) + "% fragmented");
+	}
+}
+
+
+
+VkDeviceSize VulkanAllocator::PreferredBlockSize(uint32_t memoryType) const
+{
+	VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+	if(heapSize <= SMALL_HEAP_LIMIT)
+		return AlignUp(heapSize / 8, 32);
+	return LARGE_HEAP_BLOCK_SIZE;
+}
+
+
+
+VulkanMemoryBlock *VulkanAllocator::CreateBlock(uint32_t poolIndex, VkDeviceSize size, bool dedicated)
+{
+	Pool &pool = pools[poolIndex];
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = pool.memoryType;
+
+	auto block = std::make_unique<VulkanMemoryBlock>();
+	if(vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate device memory block!");
+
+	block->size = size;
+	block->pool = poolIndex;
+	block->dedicated = dedicated;
+	block->freeRanges.push_back({0, size});
+
+	// Host visible blocks are mapped once for their whole lifetime, every allocation just points into them.
+	if(memoryProperties.memoryTypes[pool.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		if(vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped) != VK_SUCCESS)
+			throw std::runtime_error("failed to map device memory block!");
+
+	pool.blocks.emplace_back(std::move(block));
+	return pool.blocks.back().get();
+}
+
+
+
+void VulkanAllocator::DestroyBlock(VulkanMemoryBlock &block)
+{
+	if(block.mapped)
+		vkUnmapMemory(device, block.memory);
+	vkFreeMemory(device, block.memory, nullptr);
+	block.memory = VK_NULL_HANDLE;
+	block.mapped = nullptr;
+}
+
+
+
+bool VulkanAllocator::TryAllocate(VulkanMemoryBlock &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset)
+{
+	for(size_t i = 0; i < block.freeRanges.size(); i++)
+	{
+		VulkanMemoryBlock::Range range = block.freeRanges[i];
+		VkDeviceSize alignedOffset = AlignUp(range.offset, alignment);
+		VkDeviceSize padding = alignedOffset - range.offset;
+		if(padding + size > range.size)
+			continue;
+
+		// Split the free range into the alignment padding in front and the remainder after the allocation.
+		VkDeviceSize tailOffset = alignedOffset + size;
+		VkDeviceSize tailSize = range.offset + range.size - tailOffset;
+		block.freeRanges.erase(block.freeRanges.begin() + i);
+		if(tailSize)
+			block.freeRanges.insert(block.freeRanges.begin() + i, {tailOffset, tailSize});
+		if(padding)
+			block.freeRanges.insert(block.freeRanges.begin() + i, {range.offset, padding});
+
+		block.allocationCount++;
+		block.usedBytes += size;
+		offset = alignedOffset;
+		return true;
+	}
+	return false;
+}
+
+
+
+void VulkanAllocator::Release(VulkanMemoryBlock &block, VkDeviceSize offset, VkDeviceSize size)
+{
+	auto &ranges = block.freeRanges;
+	auto it = std::lower_bound(ranges.begin(), ranges.end(), offset,
+		[](const VulkanMemoryBlock::Range &range, VkDeviceSize value) { return range.offset < value; });
+	it = ranges.insert(it, {offset, size});
+
+	// Merge with the following range first, so that the iterator stays valid for the preceding merge.
+	auto next = it + 1;
+	if(next != ranges.end() && it->offset + it->size == next->offset)
+	{
+		it->size += next->size;
+		ranges.erase(next);
+	}
+	if(it != ranges.begin())
+	{
+		auto previous = it - 1;
+		if(previous->offset + previous->size == it->offset)
+		{
+			previous->size += it->size;
+			ranges.erase(it);
+		}
+	}
+
+	block.allocationCount--;
+	block.usedBytes -= size;
+}
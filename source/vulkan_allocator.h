@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+struct VulkanMemoryBlock;
+
+// A sub-range of a larger VkDeviceMemory block handed out by the VulkanAllocator.
+struct VulkanAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void *mapped = nullptr;
+	uint32_t memoryType = 0;
+	VulkanMemoryBlock *block = nullptr;
+};
+
+struct VulkanHeapStats {
+	uint32_t heapIndex = 0;
+	VkDeviceSize heapSize = 0;
+	uint32_t blockCount = 0;
+	uint32_t allocationCount = 0;
+	VkDeviceSize blockBytes = 0;
+	VkDeviceSize usedBytes = 0;
+	uint32_t freeRangeCount = 0;
+	VkDeviceSize largestFreeRange = 0;
+};
+
+struct VulkanMemoryBlock {
+	struct Range {
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	VkDeviceSize usedBytes = 0;
+	void *mapped = nullptr;
+	uint32_t allocationCount = 0;
+	uint32_t pool = 0;
+	bool dedicated = false;
+	// Free ranges sorted by offset, neighbours are always coalesced.
+	std::vector<Range> freeRanges;
+};
+
+
+
+class VulkanAllocator {
+public:
+	VulkanAllocator(VkDevice device, VkPhysicalDevice physicalDevice);
+	~VulkanAllocator();
+
+	VulkanAllocator(const VulkanAllocator &) = delete;
+	VulkanAllocator &operator=(const VulkanAllocator &) = delete;
+
+	// Buffers and linear images must pass optimalTiling = false, optimal tiled images true.
+	// Both kinds live in separate pools, so bufferImageGranularity never has to be considered.
+	VulkanAllocation Allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool optimalTiling);
+	void Free(VulkanAllocation &allocation);
+
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+	// Returns a range that is valid for vkFlushMappedMemoryRanges / vkInvalidateMappedMemoryRanges.
+	VkMappedMemoryRange MappedRange(const VulkanAllocation &allocation, VkDeviceSize size, VkDeviceSize offset) const;
+
+	std::vector<VulkanHeapStats> GetHeapStats() const;
+	void LogStats() const;
+
+private:
+	struct Pool {
+		uint32_t memoryType;
+		bool optimalTiling;
+		std::vector<std::unique_ptr<VulkanMemoryBlock>> blocks;
+	};
+
+	VkDeviceSize PreferredBlockSize(uint32_t memoryType) const;
+	VulkanMemoryBlock *CreateBlock(uint32_t poolIndex, VkDeviceSize size, bool dedicated);
+	void DestroyBlock(VulkanMemoryBlock &block);
+	static bool TryAllocate(VulkanMemoryBlock &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+	static void Release(VulkanMemoryBlock &block, VkDeviceSize offset, VkDeviceSize size);
+
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize nonCoherentAtomSize;
+
+	mutable std::mutex mutex;
+	std::vector<Pool> pools;
+};
@@ -15,13 +15,13 @@ VkDeviceSize VulkanBuffer::GetAlignment(VkDeviceSize instanceSize, VkDeviceSize
 
 
 VulkanBuffer::VulkanBuffer(VulkanDevice &device, VkDeviceSize instanceSize, uint32_t instanceCount, VkBufferUsageFlags usageFlags,
-	VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize minOffsetAlignment)
+	VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize minOffsetAlignment, bool concurrent)
 : device{device}, instanceSize{instanceSize}, instanceCount{instanceCount}, usageFlags{usageFlags},
 	memoryPropertyFlags{memoryPropertyFlags}
 {
 	alignmentSize = GetAlignment(instanceSize, minOffsetAlignment);
 	bufferSize = alignmentSize * instanceCount;
-	device.CreateBuffer(bufferSize, usageFlags, memoryPropertyFlags, buffer, memory);
+	device.CreateBuffer(bufferSize, usageFlags, memoryPropertyFlags, buffer, allocation, concurrent);
 }
 
 
@@ -30,26 +30,26 @@ VulkanBuffer::~VulkanBuffer()
 {
 	Unmap();
 	vkDestroyBuffer(device.Device(), buffer, nullptr);
-	vkFreeMemory(device.Device(), memory, nullptr);
+	device.FreeAllocation(allocation);
 }
 
 
 
 VkResult VulkanBuffer::Map(VkDeviceSize size, VkDeviceSize offset)
 {
-	assert(buffer && memory && "Called map on buffer before create");
-	return vkMapMemory(device.Device(), memory, offset, size, 0, &mapped);
+	assert(buffer && allocation.memory && "Called map on buffer before create");
+	// The allocator keeps host visible blocks persistently mapped, so mapping only hands out a pointer.
+	if(!allocation.mapped)
+		return VK_ERROR_MEMORY_MAP_FAILED;
+	mapped = static_cast<char *>(allocation.mapped) + offset;
+	return VK_SUCCESS;
 }
 
 
 
 void VulkanBuffer::Unmap()
 {
-	if(mapped)
-	{
-		vkUnmapMemory(device.Device(), memory);
-		mapped = nullptr;
-	}
+	mapped = nullptr;
 }
 
 
@@ -72,11 +72,7 @@ void VulkanBuffer::WriteToBuffer(void *data, VkDeviceSize size, VkDeviceSize off
 
 VkResult VulkanBuffer::Flush(VkDeviceSize size, VkDeviceSize offset)
 {
-	VkMappedMemoryRange mappedRange = {};
-	mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-	mappedRange.memory = memory;
-	mappedRange.offset = offset;
-	mappedRange.size = size;
+	VkMappedMemoryRange mappedRange = device.Allocator().MappedRange(allocation, size, offset);
 	return vkFlushMappedMemoryRanges(device.Device(), 1, &mappedRange);
 }
 
@@ -84,11 +80,7 @@ VkResult VulkanBuffer::Flush(VkDeviceSize size, VkDeviceSize offset)
 
 VkResult VulkanBuffer::Invalidate(VkDeviceSize size, VkDeviceSize offset)
 {
-	VkMappedMemoryRange mappedRange = {};
-	mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-	mappedRange.memory = memory;
-	mappedRange.offset = offset;
-	mappedRange.size = size;
+	VkMappedMemoryRange mappedRange = device.Allocator().MappedRange(allocation, size, offset);
 	return vkInvalidateMappedMemoryRanges(device.Device(), 1, &mappedRange);
 }
 
@@ -7,7 +7,7 @@
 class VulkanBuffer {
 public:
 	VulkanBuffer(VulkanDevice &device, VkDeviceSize instanceSize, uint32_t instanceCount, VkBufferUsageFlags usageFlags,
-		VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize minOffsetAlignment = 1);
+		VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize minOffsetAlignment = 1, bool concurrent = false);
 	~VulkanBuffer();
 
 	VulkanBuffer(const VulkanBuffer&) = delete;
@@ -27,6 +27,7 @@ public:
 	VkResult InvalidateIndex(int index);
 	
 	VkBuffer GetBuffer() const { return buffer; }
+	const VulkanAllocation &GetAllocation() const { return allocation; }
 	void *GetMappedMemory() const { return mapped; }
 	uint32_t GetInstanceCount() const { return instanceCount; }
 	VkDeviceSize GetInstanceSize() const { return instanceSize; }
@@ -41,7 +42,7 @@ private:
 	VulkanDevice &device;
 	void *mapped = nullptr;
 	VkBuffer buffer = VK_NULL_HANDLE;
-	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VulkanAllocation allocation;
 
 	VkDeviceSize bufferSize;
 	uint32_t instanceCount;
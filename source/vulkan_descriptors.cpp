@@ -6,7 +6,7 @@
 
 
 VulkanDescriptorSetLayout::Builder &VulkanDescriptorSetLayout::Builder::AddBinding(uint32_t binding, VkDescriptorType descriptorType,
-	VkShaderStageFlags stageFlags, uint32_t count)
+	VkShaderStageFlags stageFlags, uint32_t count, VkDescriptorBindingFlags flags)
 {
 	assert(bindings.count(binding) == 0 && "Binding already in use");
 	VkDescriptorSetLayoutBinding layoutBinding{};
@@ -15,6 +15,8 @@ VulkanDescriptorSetLayout::Builder &VulkanDescriptorSetLayout::Builder::AddBindi
 	layoutBinding.descriptorCount = count;
 	layoutBinding.stageFlags = stageFlags;
 	bindings[binding] = layoutBinding;
+	if(flags)
+		bindingFlags[binding] = flags;
 	return *this;
 }
 
@@ -22,22 +24,39 @@ VulkanDescriptorSetLayout::Builder &VulkanDescriptorSetLayout::Builder::AddBindi
 
 std::unique_ptr<VulkanDescriptorSetLayout> VulkanDescriptorSetLayout::Builder::Build() const
 {
-	return std::make_unique<VulkanDescriptorSetLayout>(device, bindings);
+	return std::make_unique<VulkanDescriptorSetLayout>(device, bindings, bindingFlags);
 }
 
 
 
-VulkanDescriptorSetLayout::VulkanDescriptorSetLayout(VulkanDevice &device, std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings)
+VulkanDescriptorSetLayout::VulkanDescriptorSetLayout(VulkanDevice &device, std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings,
+	std::unordered_map<uint32_t, VkDescriptorBindingFlags> bindingFlags)
 : device{device}, bindings{bindings}
 {
 	std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings{};
+	std::vector<VkDescriptorBindingFlags> setLayoutBindingFlags{};
+	bool updateAfterBind = false;
 	for(auto kv : bindings)
+	{
 		setLayoutBindings.push_back(kv.second);
+		auto flags = bindingFlags.find(kv.first);
+		setLayoutBindingFlags.push_back(flags == bindingFlags.end() ? 0 : flags->second);
+		updateAfterBind |= (setLayoutBindingFlags.back() & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT) != 0;
+	}
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsInfo.bindingCount = static_cast<uint32_t>(setLayoutBindingFlags.size());
+	bindingFlagsInfo.pBindingFlags = setLayoutBindingFlags.data();
 
 	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo{};
 	descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	descriptorSetLayoutInfo.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
 	descriptorSetLayoutInfo.pBindings = setLayoutBindings.data();
+	if(!bindingFlags.empty())
+		descriptorSetLayoutInfo.pNext = &bindingFlagsInfo;
+	if(updateAfterBind)
+		descriptorSetLayoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
 
 	if(vkCreateDescriptorSetLayout(device.Device(), &descriptorSetLayoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
 		throw std::runtime_error("failed to create descriptor set layout!");
@@ -52,6 +71,14 @@ VulkanDescriptorSetLayout::~VulkanDescriptorSetLayout()
 
 
 
+const VkDescriptorSetLayoutBinding *VulkanDescriptorSetLayout::FindBinding(uint32_t binding) const
+{
+	auto it = bindings.find(binding);
+	return it == bindings.end() ? nullptr : &it->second;
+}
+
+
+
 VulkanDescriptorPool::Builder &VulkanDescriptorPool::Builder::AddPoolSize(VkDescriptorType descriptorType, uint32_t count)
 {
 	poolSizes.push_back({descriptorType, count});
@@ -107,13 +134,21 @@ VulkanDescriptorPool::~VulkanDescriptorPool()
 
 
 
-bool VulkanDescriptorPool::AllocateDescriptor(const VkDescriptorSetLayout descriptorSetLayout, VkDescriptorSet &descriptor) const
+bool VulkanDescriptorPool::AllocateDescriptor(const VkDescriptorSetLayout descriptorSetLayout, VkDescriptorSet &descriptor,
+	uint32_t variableDescriptorCount) const
 {
+	VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountInfo{};
+	variableCountInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+	variableCountInfo.descriptorSetCount = 1;
+	variableCountInfo.pDescriptorCounts = &variableDescriptorCount;
+
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
 	allocInfo.pSetLayouts = &descriptorSetLayout;
 	allocInfo.descriptorSetCount = 1;
+	if(variableDescriptorCount)
+		allocInfo.pNext = &variableCountInfo;
 
 	if(vkAllocateDescriptorSets(device.Device(), &allocInfo, &descriptor) != VK_SUCCESS)
 		return false;
@@ -163,18 +198,19 @@ VulkanDescriptorWriter &VulkanDescriptorWriter::WriteBuffer(uint32_t binding, Vk
 
 
 
-VulkanDescriptorWriter &VulkanDescriptorWriter::WriteImage(uint32_t binding, VkDescriptorImageInfo *imageInfo)
+VulkanDescriptorWriter &VulkanDescriptorWriter::WriteImage(uint32_t binding, VkDescriptorImageInfo *imageInfo, uint32_t arrayElement)
 {
 	assert(setLayout.bindings.count(binding) == 1 && "Layout does not contain specified binding");
 
 	auto &bindingDescription = setLayout.bindings[binding];
 
-	assert(bindingDescription.descriptorCount == 1 && "Binding single descriptor info, but binding expects multiple");
+	assert(arrayElement < bindingDescription.descriptorCount && "Array element out of range for binding");
 
 	VkWriteDescriptorSet write{};
 	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	write.descriptorType = bindingDescription.descriptorType;
 	write.dstBinding = binding;
+	write.dstArrayElement = arrayElement;
 	write.pImageInfo = imageInfo;
 	write.descriptorCount = 1;
 
@@ -184,9 +220,9 @@ VulkanDescriptorWriter &VulkanDescriptorWriter::WriteImage(uint32_t binding, VkD
 
 
 
-bool VulkanDescriptorWriter::Build(VkDescriptorSet &set)
+bool VulkanDescriptorWriter::Build(VkDescriptorSet &set, uint32_t variableDescriptorCount)
 {
-	bool success = pool.AllocateDescriptor(setLayout.GetDescriptorSetLayout(), set);
+	bool success = pool.AllocateDescriptor(setLayout.GetDescriptorSetLayout(), set, variableDescriptorCount);
 	if (!success)
 		return false;
 
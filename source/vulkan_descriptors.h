@@ -13,21 +13,27 @@ public:
 	public:
 		Builder(VulkanDevice &device) : device{device} {}
  
-		Builder &AddBinding(uint32_t binding, VkDescriptorType descriptorType, VkShaderStageFlags stageFlags, uint32_t count = 1);
+		// Binding flags come from descriptor indexing, e.g. partially bound or update after bind arrays.
+		Builder &AddBinding(uint32_t binding, VkDescriptorType descriptorType, VkShaderStageFlags stageFlags, uint32_t count = 1,
+			VkDescriptorBindingFlags flags = 0);
 		std::unique_ptr<VulkanDescriptorSetLayout> Build() const;
 
 	private:
 		VulkanDevice &device;
 		std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings{};
+		std::unordered_map<uint32_t, VkDescriptorBindingFlags> bindingFlags{};
 	};
 
-	VulkanDescriptorSetLayout(VulkanDevice &device, std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings);
+	VulkanDescriptorSetLayout(VulkanDevice &device, std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings,
+		std::unordered_map<uint32_t, VkDescriptorBindingFlags> bindingFlags = {});
 	~VulkanDescriptorSetLayout();
 
 	VulkanDescriptorSetLayout(const VulkanDescriptorSetLayout &) = delete;
 	VulkanDescriptorSetLayout &operator=(const VulkanDescriptorSetLayout &) = delete;
 
 	VkDescriptorSetLayout GetDescriptorSetLayout() const { return descriptorSetLayout; }
+	// Null if the layout has no such binding.
+	const VkDescriptorSetLayoutBinding *FindBinding(uint32_t binding) const;
 
 private:
 	VulkanDevice &device;
@@ -63,7 +69,9 @@ public:
 	VulkanDescriptorPool(const VulkanDescriptorPool &) = delete;
 	VulkanDescriptorPool &operator=(const VulkanDescriptorPool &) = delete;
 
-	bool AllocateDescriptor(const VkDescriptorSetLayout descriptorSetLayout, VkDescriptorSet &descriptor) const;
+	// A variable descriptor count is only used by layouts whose last binding has a variable size.
+	bool AllocateDescriptor(const VkDescriptorSetLayout descriptorSetLayout, VkDescriptorSet &descriptor,
+		uint32_t variableDescriptorCount = 0) const;
 	void FreeDescriptors(std::vector<VkDescriptorSet> &descriptors) const;
 	void ResetPool();
 
@@ -81,9 +89,9 @@ public:
 	VulkanDescriptorWriter(VulkanDescriptorSetLayout &setLayout, VulkanDescriptorPool &pool);
 
 	VulkanDescriptorWriter &WriteBuffer(uint32_t binding, VkDescriptorBufferInfo *bufferInfo);
-	VulkanDescriptorWriter &WriteImage(uint32_t binding, VkDescriptorImageInfo *imageInfo);
+	VulkanDescriptorWriter &WriteImage(uint32_t binding, VkDescriptorImageInfo *imageInfo, uint32_t arrayElement = 0);
 
-	bool Build(VkDescriptorSet &set);
+	bool Build(VkDescriptorSet &set, uint32_t variableDescriptorCount = 0);
 	void Overwrite(VkDescriptorSet &set);
 
 private:
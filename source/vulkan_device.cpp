@@ -1,7 +1,12 @@
 #include "vulkan_device.h"
 
 #include "logger.h"
+#include "vulkan_layout_cache.h"
+#include "vulkan_pipeline_cache.h"
+#include "vulkan_shader_library.h"
+#include "vulkan_staging_ring.h"
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <set>
@@ -45,25 +50,47 @@ namespace {
 VulkanDevice::VulkanDevice(Window &window)
 : window{window}
 {
+	enableValidationLayers = VALIDATION_REQUESTED && !window.IsHeadless();
 	CreateInstance();
 	SetupDebugMessenger();
 	CreateSurface();
 	PickPhysicalDevice();
 	CreateLogicalDevice();
+	allocator = std::make_unique<VulkanAllocator>(device_, physicalDevice);
 	CreateCommandPool();
+	CreateFrameTimeline();
+	stagingRing = std::make_unique<VulkanStagingRing>(*this);
+	layoutCache = std::make_unique<VulkanLayoutCache>(*this);
+	pipelineCache = std::make_unique<VulkanPipelineCache>(*this, VulkanPipelineCache::DEFAULT_FILE, creationFeedback);
+	shaderLibrary = std::make_unique<VulkanShaderLibrary>(*this);
 }
 
 
 
 VulkanDevice::~VulkanDevice()
 {
+	WaitForUpload(submittedUploads);
+	for(VkFence fence : freeFences)
+		vkDestroyFence(device_, fence, nullptr);
+	for(VkSemaphore semaphore : freeSemaphores)
+		vkDestroySemaphore(device_, semaphore, nullptr);
+	shaderLibrary.reset();
+	pipelineCache.reset();
+	layoutCache.reset();
+	stagingRing.reset();
+	vkDestroySemaphore(device_, frameTimeline, nullptr);
+
+	if(transferCommandPool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(device_, transferCommandPool, nullptr);
 	vkDestroyCommandPool(device_, commandPool, nullptr);
+	allocator.reset();
 	vkDestroyDevice(device_, nullptr);
 
 	if(enableValidationLayers)
 		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 
-	vkDestroySurfaceKHR(instance, surface_, nullptr);
+	if(surface_ != VK_NULL_HANDLE)
+		vkDestroySurfaceKHR(instance, surface_, nullptr);
 	vkDestroyInstance(instance, nullptr);
 }
 
@@ -80,7 +107,7 @@ void VulkanDevice::CreateInstance()
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.pEngineName = "ES Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_2;
 
 	VkInstanceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -143,10 +170,11 @@ void VulkanDevice::PickPhysicalDevice()
 
 void VulkanDevice::CreateLogicalDevice()
 {
-	QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
+	queueFamilies = FindQueueFamilies(physicalDevice);
+	const QueueFamilyIndices &indices = queueFamilies;
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily};
+	std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily, indices.transferFamily};
 
 	float queuePriority = 1.0f;
 	for(uint32_t queueFamily : uniqueQueueFamilies)
@@ -162,15 +190,69 @@ void VulkanDevice::CreateLogicalDevice()
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12Features.timelineSemaphore = VK_TRUE;
+	// Needed for the bindless texture table.
+	vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+	vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+	vulkan12Features.descriptorBindingVariableDescriptorCount = VK_TRUE;
+	vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = &vulkan12Features;
 
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
+	std::vector<const char *> extensions = GetDeviceExtensions();
+	creationFeedback = IsDeviceExtensionSupported(physicalDevice, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+	if(creationFeedback)
+		extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+
+	// Extended dynamic state is optional, without it every render state gets a pipeline of its own.
+	VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatures = {};
+	dynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+	VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamicState3Features = {};
+	dynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	bool hasDynamicState = IsDeviceExtensionSupported(physicalDevice, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+	bool hasDynamicState3 = IsDeviceExtensionSupported(physicalDevice, VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+	if(hasDynamicState)
+	{
+		supportedFeatures.pNext = &dynamicStateFeatures;
+		if(hasDynamicState3)
+			dynamicStateFeatures.pNext = &dynamicState3Features;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+	}
+
+	bool rasterState = hasDynamicState && dynamicStateFeatures.extendedDynamicState;
+	bool blendState = rasterState && hasDynamicState3 && dynamicState3Features.extendedDynamicState3ColorBlendEnable
+		&& dynamicState3Features.extendedDynamicState3ColorBlendEquation;
+	if(rasterState)
+	{
+		extensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+		dynamicStateFeatures = {};
+		dynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+		dynamicStateFeatures.extendedDynamicState = VK_TRUE;
+		vulkan12Features.pNext = &dynamicStateFeatures;
+	}
+	if(blendState)
+	{
+		extensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+		dynamicState3Features = {};
+		dynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+		dynamicState3Features.extendedDynamicState3ColorBlendEnable = VK_TRUE;
+		dynamicState3Features.extendedDynamicState3ColorBlendEquation = VK_TRUE;
+		dynamicStateFeatures.pNext = &dynamicState3Features;
+	}
+
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
 
 
 	if(enableValidationLayers)
@@ -186,6 +268,54 @@ void VulkanDevice::CreateLogicalDevice()
 
 	vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphicsQueue_);
 	vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+	vkGetDeviceQueue(device_, indices.transferFamily, 0, &transferQueue_);
+
+	dedicatedTransfer = indices.HasDedicatedTransfer();
+	Logger::Status(dedicatedTransfer ? "Uploads use a dedicated transfer queue" : "Uploads use the graphics queue");
+
+	LoadDynamicStateCommands(rasterState, blendState);
+}
+
+
+
+void VulkanDevice::LoadDynamicStateCommands(bool rasterState, bool blendState)
+{
+	if(rasterState)
+	{
+		dynamicState.setCullMode = reinterpret_cast<PFN_vkCmdSetCullModeEXT>(
+			vkGetDeviceProcAddr(device_, "vkCmdSetCullModeEXT"));
+		dynamicState.setFrontFace = reinterpret_cast<PFN_vkCmdSetFrontFaceEXT>(
+			vkGetDeviceProcAddr(device_, "vkCmdSetFrontFaceEXT"));
+		dynamicState.setPrimitiveTopology = reinterpret_cast<PFN_vkCmdSetPrimitiveTopologyEXT>(
+			vkGetDeviceProcAddr(device_, "vkCmdSetPrimitiveTopologyEXT"));
+		dynamicState.setDepthTestEnable = reinterpret_cast<PFN_vkCmdSetDepthTestEnableEXT>(
+			vkGetDeviceProcAddr(device_, "vkCmdSetDepthTestEnableEXT"));
+		dynamicState.setDepthWriteEnable = reinterpret_cast<PFN_vkCmdSetDepthWriteEnableEXT>(
+			vkGetDeviceProcAddr(device_, "vkCmdSetDepthWriteEnableEXT"));
+		if(!dynamicState.setCullMode || !dynamicState.setFrontFace || !dynamicState.setPrimitiveTopology
+				|| !dynamicState.setDepthTestEnable || !dynamicState.setDepthWriteEnable)
+			dynamicState = {};
+	}
+	if(blendState && dynamicState.HasRasterState())
+	{
+		dynamicState.setColorBlendEnable = reinterpret_cast<PFN_vkCmdSetColorBlendEnableEXT>(
+			vkGetDeviceProcAddr(device_, "vkCmdSetColorBlendEnableEXT"));
+		dynamicState.setColorBlendEquation = reinterpret_cast<PFN_vkCmdSetColorBlendEquationEXT>(
+			vkGetDeviceProcAddr(device_, "vkCmdSetColorBlendEquationEXT"));
+		if(!dynamicState.setColorBlendEnable)
+			dynamicState.setColorBlendEquation = nullptr;
+
+		VkPhysicalDeviceExtendedDynamicState3PropertiesEXT dynamicState3Properties = {};
+		dynamicState3Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_PROPERTIES_EXT;
+		VkPhysicalDeviceProperties2 properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &dynamicState3Properties;
+		vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+		dynamicState.unrestrictedTopology = dynamicState3Properties.dynamicPrimitiveTopologyUnrestricted;
+	}
+
+	Logger::Status(std::string("Extended dynamic state: ") + (dynamicState.HasRasterState() ? "raster" : "none")
+		+ (dynamicState.HasBlendState() ? ", blend" : ""));
 }
 
 
@@ -197,17 +327,43 @@ void VulkanDevice::CreateCommandPool()
 	VkCommandPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-	poolInfo.flags =
-			VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	// Only used for one-time upload commands, which are freed and never reset.
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
 	if(vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
 		throw std::runtime_error("failed to create command pool!");
+
+	if(dedicatedTransfer)
+	{
+		poolInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
+		if(vkCreateCommandPool(device_, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create transfer command pool!");
+	}
+}
+
+
+
+void VulkanDevice::CreateFrameTimeline()
+{
+	VkSemaphoreTypeCreateInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &timelineInfo;
+
+	if(vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &frameTimeline) != VK_SUCCESS)
+		throw std::runtime_error("failed to create frame timeline semaphore!");
 }
 
 
 
 void VulkanDevice::CreateSurface()
 {
+	if(window.IsHeadless())
+		return;
 	window.CreateWindowSurface(instance, &surface_);
 }
 
@@ -219,17 +375,30 @@ bool VulkanDevice::IsDeviceSuitable(VkPhysicalDevice device)
 
 	bool extensionsSupported = CheckDeviceExtensionSupport(device);
 
-	bool swapChainAdequate = false;
-	if(extensionsSupported)
+	// Headless rendering never presents, any format the offscreen images can use will do.
+	bool swapChainAdequate = window.IsHeadless();
+	if(extensionsSupported && !swapChainAdequate)
 	{
 		SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(device);
 		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
 	}
 
-	VkPhysicalDeviceFeatures supportedFeatures;
-	vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
-
-	return indices.IsComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device, &deviceProperties);
+	if(deviceProperties.apiVersion < VK_API_VERSION_1_2)
+		return false;
+
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &vulkan12Features;
+	vkGetPhysicalDeviceFeatures2(device, &supportedFeatures);
+
+	return indices.IsComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.features.samplerAnisotropy
+		&& vulkan12Features.timelineSemaphore && vulkan12Features.runtimeDescriptorArray
+		&& vulkan12Features.shaderSampledImageArrayNonUniformIndexing && vulkan12Features.descriptorBindingPartiallyBound
+		&& vulkan12Features.descriptorBindingVariableDescriptorCount && vulkan12Features.descriptorBindingSampledImageUpdateAfterBind;
 }
 
 
@@ -292,11 +461,14 @@ bool VulkanDevice::CheckValidationLayerSupport()
 
 std::vector<const char *> VulkanDevice::GetRequiredExtensions()
 {
-	uint32_t glfwExtensionCount = 0;
-	const char **glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-	std::vector<const char *> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	std::vector<const char *> extensions;
+	if(!window.IsHeadless())
+	{
+		uint32_t glfwExtensionCount = 0;
+		const char **glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
 	if (enableValidationLayers)
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -337,6 +509,15 @@ void VulkanDevice::HasRequiredInstanceExtensions()
 
 
 
+std::vector<const char *> VulkanDevice::GetDeviceExtensions() const
+{
+	if(window.IsHeadless())
+		return {};
+	return deviceExtensions;
+}
+
+
+
 bool VulkanDevice::CheckDeviceExtensionSupport(VkPhysicalDevice device)
 {
 	uint32_t extensionCount;
@@ -345,7 +526,8 @@ bool VulkanDevice::CheckDeviceExtensionSupport(VkPhysicalDevice device)
 	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+	std::vector<const char *> extensions = GetDeviceExtensions();
+	std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
 	for(const auto &extension : availableExtensions)
 		requiredExtensions.erase(extension.extensionName);
@@ -355,6 +537,22 @@ bool VulkanDevice::CheckDeviceExtensionSupport(VkPhysicalDevice device)
 
 
 
+bool VulkanDevice::IsDeviceExtensionSupported(VkPhysicalDevice device, const char *extension)
+{
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	for(const auto &available : availableExtensions)
+		if(strcmp(available.extensionName, extension) == 0)
+			return true;
+	return false;
+}
+
+
+
 QueueFamilyIndices VulkanDevice::FindQueueFamilies(VkPhysicalDevice device)
 {
 	QueueFamilyIndices indices;
@@ -366,26 +564,45 @@ QueueFamilyIndices VulkanDevice::FindQueueFamilies(VkPhysicalDevice device)
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
 	int i = 0;
+	bool transferOnly = false;
 	for(const auto &queueFamily : queueFamilies)
 	{
-		if(queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		if(queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT && !indices.graphicsFamilyHasValue)
 		{
 			indices.graphicsFamily = i;
 			indices.graphicsFamilyHasValue = true;
 		}
+		// Headless frames are never presented, the graphics family stands in for the present one.
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
-		if(queueFamily.queueCount > 0 && presentSupport)
+		if(surface_ == VK_NULL_HANDLE)
+			presentSupport = queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT ? VK_TRUE : VK_FALSE;
+		else
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
+		if(queueFamily.queueCount > 0 && presentSupport && !indices.presentFamilyHasValue)
 		{
 			indices.presentFamily = i;
 			indices.presentFamilyHasValue = true;
 		}
-		if(indices.IsComplete())
-			break;
+		// Prefer a pure transfer family (usually backed by a copy engine) over an async compute one.
+		bool isTransfer = queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT
+			&& !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+		bool isTransferOnly = isTransfer && !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
+		if(isTransfer && (!indices.transferFamilyHasValue || (isTransferOnly && !transferOnly)))
+		{
+			indices.transferFamily = i;
+			indices.transferFamilyHasValue = true;
+			transferOnly = isTransferOnly;
+		}
 
 		i++;
 	}
 
+	if(!indices.transferFamilyHasValue && indices.graphicsFamilyHasValue)
+	{
+		indices.transferFamily = indices.graphicsFamily;
+		indices.transferFamilyHasValue = true;
+	}
+
 	return indices;
 }
 
@@ -437,19 +654,13 @@ VkFormat VulkanDevice::FindSupportedFormat(const std::vector<VkFormat> &candidat
 
 uint32_t VulkanDevice::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
 {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-	for(uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-		if((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-			return i;
-
-	throw std::runtime_error("failed to find suitable memory type!");
+	return allocator->FindMemoryType(typeFilter, properties);
 }
 
 
 
 void VulkanDevice::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-	VkBuffer &buffer, VkDeviceMemory &bufferMemory)
+	VkBuffer &buffer, VulkanAllocation &bufferAllocation, bool concurrent)
 {
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -457,21 +668,25 @@ void VulkanDevice::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkM
 	bufferInfo.usage = usage;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+	const QueueFamilyIndices &indices = FindPhysicalQueueFamilies();
+	uint32_t queueFamilyIndices[] = {indices.graphicsFamily, indices.transferFamily};
+	if(concurrent && dedicatedTransfer)
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
+
 	if(vkCreateBuffer(device_, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
-		throw std::runtime_error("failed to create vertex buffer!");
+		throw std::runtime_error("failed to create buffer!");
 
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device_, buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+	bufferAllocation = allocator->Allocate(memRequirements, properties, false);
 
-	if(vkAllocateMemory(device_, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate vertex buffer memory!");
-
-	vkBindBufferMemory(device_, buffer, bufferMemory, 0);
+	if(vkBindBufferMemory(device_, buffer, bufferAllocation.memory, bufferAllocation.offset) != VK_SUCCESS)
+		throw std::runtime_error("failed to bind vertex buffer memory!");
 }
 
 
@@ -501,65 +716,172 @@ void VulkanDevice::EndSingleTimeCommands(VkCommandBuffer commandBuffer)
 {
 	vkEndCommandBuffer(commandBuffer);
 
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	uint64_t submission = SubmitUpload(commandBuffer);
+	stagingRing->Retire(submission);
+	WaitForUpload(submission);
+}
+
+
 
-	vkQueueSubmit(graphicsQueue_, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(graphicsQueue_);
+uint64_t VulkanDevice::SubmitUpload(VkCommandBuffer graphicsCommandBuffer, VkCommandBuffer transferCommandBuffer)
+{
+	VkFence fence;
+	if(freeFences.empty())
+	{
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if(vkCreateFence(device_, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to create upload fence!");
+	}
+	else
+	{
+		fence = freeFences.back();
+		freeFences.pop_back();
+	}
+
+	// The graphics part acquires ownership of everything the transfer part released, so it has to wait for it.
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	if(transferCommandBuffer != VK_NULL_HANDLE && graphicsCommandBuffer != VK_NULL_HANDLE)
+	{
+		if(freeSemaphores.empty())
+		{
+			VkSemaphoreCreateInfo semaphoreInfo{};
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			if(vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+				throw std::runtime_error("failed to create upload semaphore!");
+		}
+		else
+		{
+			semaphore = freeSemaphores.back();
+			freeSemaphores.pop_back();
+		}
+	}
+
+	if(transferCommandBuffer != VK_NULL_HANDLE)
+	{
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &transferCommandBuffer;
+		submitInfo.signalSemaphoreCount = semaphore != VK_NULL_HANDLE;
+		submitInfo.pSignalSemaphores = &semaphore;
+
+		VkFence transferFence = graphicsCommandBuffer == VK_NULL_HANDLE ? fence : VK_NULL_HANDLE;
+		if(vkQueueSubmit(transferQueue_, 1, &submitInfo, transferFence) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit transfer command buffer!");
+	}
 
-	vkFreeCommandBuffers(device_, commandPool, 1, &commandBuffer);
+	if(graphicsCommandBuffer != VK_NULL_HANDLE)
+	{
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = semaphore != VK_NULL_HANDLE;
+		submitInfo.pWaitSemaphores = &semaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &graphicsCommandBuffer;
+
+		if(vkQueueSubmit(graphicsQueue_, 1, &submitInfo, fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit upload command buffer!");
+	}
+
+	pendingUploads.push_back({++submittedUploads, fence, semaphore, graphicsCommandBuffer, transferCommandBuffer});
+	return submittedUploads;
+}
+
+
+
+bool VulkanDevice::IsUploadComplete(uint64_t submission)
+{
+	// Retire in submission order, so completedUploads never runs ahead of a still pending submission.
+	while(completedUploads < submission && !pendingUploads.empty()
+		&& vkGetFenceStatus(device_, pendingUploads.front().fence) == VK_SUCCESS)
+	{
+		PendingUpload &upload = pendingUploads.front();
+		vkResetFences(device_, 1, &upload.fence);
+		freeFences.push_back(upload.fence);
+		if(upload.semaphore != VK_NULL_HANDLE)
+			freeSemaphores.push_back(upload.semaphore);
+		if(upload.graphicsCommandBuffer != VK_NULL_HANDLE)
+			vkFreeCommandBuffers(device_, commandPool, 1, &upload.graphicsCommandBuffer);
+		if(upload.transferCommandBuffer != VK_NULL_HANDLE)
+			vkFreeCommandBuffers(device_, transferCommandPool, 1, &upload.transferCommandBuffer);
+		completedUploads = upload.submission;
+		pendingUploads.pop_front();
+	}
+
+	return completedUploads >= submission;
+}
+
+
+
+void VulkanDevice::WaitForUpload(uint64_t submission)
+{
+	if(IsUploadComplete(submission))
+		return;
+
+	auto start = std::chrono::steady_clock::now();
+	for(const PendingUpload &upload : pendingUploads)
+	{
+		if(upload.submission > submission)
+			break;
+		vkWaitForFences(device_, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+	}
+	IsUploadComplete(submission);
+	stallTime += std::chrono::steady_clock::now() - start;
 }
 
 
 
-void VulkanDevice::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+uint64_t VulkanDevice::CompletedFrame()
 {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+	if(completedFrames < submittedFrames)
+		if(vkGetSemaphoreCounterValue(device_, frameTimeline, &completedFrames) != VK_SUCCESS)
+			throw std::runtime_error("failed to read frame timeline semaphore!");
+	return completedFrames;
+}
+
 
-	VkBufferCopy copyRegion{};
-	copyRegion.srcOffset = 0;
-	copyRegion.dstOffset = 0;
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
-	EndSingleTimeCommands(commandBuffer);
+bool VulkanDevice::IsFrameComplete(uint64_t frame)
+{
+	return frame <= completedFrames || frame <= CompletedFrame();
 }
 
 
 
-void VulkanDevice::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount)
+void VulkanDevice::WaitForFrame(uint64_t frame)
 {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+	if(IsFrameComplete(frame))
+		return;
 
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
+	auto start = std::chrono::steady_clock::now();
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &frameTimeline;
+	waitInfo.pValues = &frame;
+	if(vkWaitSemaphores(device_, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+		throw std::runtime_error("failed to wait for frame timeline!");
+	completedFrames = std::max(completedFrames, frame);
+	stallTime += std::chrono::steady_clock::now() - start;
+}
 
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = layerCount;
 
-	region.imageOffset = {0, 0, 0};
-	region.imageExtent = {width, height, 1};
 
-	vkCmdCopyBufferToImage(
-			commandBuffer,
-			buffer,
-			image,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&region);
-	EndSingleTimeCommands(commandBuffer);
+std::chrono::steady_clock::duration VulkanDevice::TakeStallTime()
+{
+	auto result = stallTime;
+	stallTime = {};
+	return result;
 }
 
 
 
 void VulkanDevice::CreateImageWithInfo(const VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties,
-	VkImage &image, VkDeviceMemory &imageMemory)
+	VkImage &image, VulkanAllocation &imageAllocation)
 {
 	if(vkCreateImage(device_, &imageInfo, nullptr, &image) != VK_SUCCESS)
 		throw std::runtime_error("failed to create image!");
@@ -567,14 +889,8 @@ void VulkanDevice::CreateImageWithInfo(const VkImageCreateInfo &imageInfo, VkMem
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device_, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if(vkAllocateMemory(device_, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate image memory!");
+	imageAllocation = allocator->Allocate(memRequirements, properties, imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL);
 
-	if(vkBindImageMemory(device_, image, imageMemory, 0) != VK_SUCCESS)
+	if(vkBindImageMemory(device_, image, imageAllocation.memory, imageAllocation.offset) != VK_SUCCESS)
 		throw std::runtime_error("failed to bind image memory!");
 }
@@ -1,15 +1,24 @@
 #pragma once
 
 #include "window.h"
+#include "vulkan_allocator.h"
 
 // std lib headers
+#include <chrono>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
 
-	
+
+class VulkanLayoutCache;
+class VulkanPipelineCache;
+class VulkanShaderLibrary;
+class VulkanStagingRing;
+
 struct SwapChainSupportDetails {
 	VkSurfaceCapabilitiesKHR capabilities;
 	std::vector<VkSurfaceFormatKHR> formats;
@@ -19,18 +28,41 @@ struct SwapChainSupportDetails {
 struct QueueFamilyIndices {
 	uint32_t graphicsFamily;
 	uint32_t presentFamily;
+	// Falls back to the graphics family if the device has no transfer-only family.
+	uint32_t transferFamily;
 	bool graphicsFamilyHasValue = false;
 	bool presentFamilyHasValue = false;
+	bool transferFamilyHasValue = false;
 	bool IsComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
+	bool HasDedicatedTransfer() { return transferFamilyHasValue && transferFamily != graphicsFamily; }
+};
+
+// Commands of VK_EXT_extended_dynamic_state and VK_EXT_extended_dynamic_state3, null where the device lacks them.
+// Pipelines bake whatever state cannot be set dynamically.
+struct ExtendedDynamicState {
+	PFN_vkCmdSetCullModeEXT setCullMode = nullptr;
+	PFN_vkCmdSetFrontFaceEXT setFrontFace = nullptr;
+	PFN_vkCmdSetPrimitiveTopologyEXT setPrimitiveTopology = nullptr;
+	PFN_vkCmdSetDepthTestEnableEXT setDepthTestEnable = nullptr;
+	PFN_vkCmdSetDepthWriteEnableEXT setDepthWriteEnable = nullptr;
+	PFN_vkCmdSetColorBlendEnableEXT setColorBlendEnable = nullptr;
+	PFN_vkCmdSetColorBlendEquationEXT setColorBlendEquation = nullptr;
+	// Without it a dynamic topology has to stay in the topology class the pipeline was created with.
+	bool unrestrictedTopology = false;
+
+	bool HasRasterState() const { return setCullMode != nullptr; }
+	bool HasBlendState() const { return setColorBlendEquation != nullptr; }
 };
 
 class VulkanDevice {
 public:
 #ifdef NDEBUG
-	const bool enableValidationLayers = true;
+	static constexpr bool VALIDATION_REQUESTED = true;
 #else
-	const bool enableValidationLayers = true;
+	static constexpr bool VALIDATION_REQUESTED = true;
 #endif
+	// Off for headless benchmarks, whose frame times the layers would distort.
+	bool enableValidationLayers = false;
 
 	VulkanDevice(Window &window);
 	~VulkanDevice();
@@ -41,36 +73,77 @@ public:
 	VulkanDevice &operator=(VulkanDevice &&) = delete;
 
 	VkCommandPool GetCommandPool() { return commandPool; }
+	VkCommandPool GetTransferCommandPool() { return transferCommandPool; }
 	VkDevice Device() { return device_; }
 	VkPhysicalDevice GetPhysicalDevice() { return physicalDevice; }
+	// Null for a headless window.
 	VkSurfaceKHR Surface() { return surface_; }
+	// Without a window there is no surface, no swapchain extension and no present queue requirement.
+	bool IsHeadless() const { return window.IsHeadless(); }
 	VkQueue GraphicsQueue() { return graphicsQueue_; }
 	VkQueue PresentQueue() { return presentQueue_; }
+	VkQueue TransferQueue() { return transferQueue_; }
+	bool HasDedicatedTransferQueue() { return dedicatedTransfer; }
+	VulkanAllocator &Allocator() { return *allocator; }
+	VulkanStagingRing &StagingRing() { return *stagingRing; }
+	VulkanLayoutCache &LayoutCache() { return *layoutCache; }
+	VulkanPipelineCache &PipelineCache() { return *pipelineCache; }
+	VulkanShaderLibrary &ShaderLibrary() { return *shaderLibrary; }
+	const ExtendedDynamicState &DynamicState() const { return dynamicState; }
 
 	SwapChainSupportDetails GetSwapChainSupport() { return QuerySwapChainSupport(physicalDevice); }
 	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-	QueueFamilyIndices FindPhysicalQueueFamilies() { return FindQueueFamilies(physicalDevice); }
+	// Looked up once when the logical device is created.
+	const QueueFamilyIndices &FindPhysicalQueueFamilies() const { return queueFamilies; }
 	VkFormat FindSupportedFormat(const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
+	// Concurrent buffers are shared by the graphics and transfer families, so uploads into them need no ownership transfer.
 	void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-		VkBuffer &buffer, VkDeviceMemory &bufferMemory);
+		VkBuffer &buffer, VulkanAllocation &bufferAllocation, bool concurrent = false);
 	VkCommandBuffer BeginSingleTimeCommands();
 	void EndSingleTimeCommands(VkCommandBuffer commandBuffer);
-	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-	void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
+
+	// Submits recorded upload command buffers and returns a submission number, which increases monotonically.
+	// A transfer command buffer runs on the transfer queue first, the graphics one waits for it on the graphics queue.
+	// Both command buffers are freed once the submission has completed.
+	uint64_t SubmitUpload(VkCommandBuffer graphicsCommandBuffer, VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE);
+	bool IsUploadComplete(uint64_t submission);
+	void WaitForUpload(uint64_t submission);
+
+	// Every frame submission signals the frame timeline semaphore with its frame number once it has completed,
+	// so any subsystem can ask whether the GPU is done with frame N without owning a fence.
+	VkSemaphore FrameTimeline() { return frameTimeline; }
+	uint64_t NextFrame() { return ++submittedFrames; }
+	uint64_t SubmittedFrame() const { return submittedFrames; }
+	uint64_t CompletedFrame();
+	bool IsFrameComplete(uint64_t frame);
+	void WaitForFrame(uint64_t frame);
+	// Returns the time the CPU spent blocked on frames and uploads since the last call.
+	std::chrono::steady_clock::duration TakeStallTime();
 
 	void CreateImageWithInfo(const VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties,
-		VkImage &image, VkDeviceMemory &imageMemory);
+		VkImage &image, VulkanAllocation &imageAllocation);
+	void FreeAllocation(VulkanAllocation &allocation) { allocator->Free(allocation); }
 
 	VkPhysicalDeviceProperties properties;
 
  private:
+	struct PendingUpload {
+		uint64_t submission;
+		VkFence fence;
+		VkSemaphore semaphore;
+		VkCommandBuffer graphicsCommandBuffer;
+		VkCommandBuffer transferCommandBuffer;
+	};
+
 	void CreateInstance();
 	void SetupDebugMessenger();
 	void CreateSurface();
 	void PickPhysicalDevice();
 	void CreateLogicalDevice();
 	void CreateCommandPool();
+	void CreateFrameTimeline();
+	void LoadDynamicStateCommands(bool rasterState, bool blendState);
 
 	bool IsDeviceSuitable(VkPhysicalDevice device);
 	std::vector<const char *> GetRequiredExtensions();
@@ -78,7 +151,9 @@ public:
 	QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device);
 	void PopulateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo);
 	void HasRequiredInstanceExtensions();
+	std::vector<const char *> GetDeviceExtensions() const;
 	bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
+	bool IsDeviceExtensionSupported(VkPhysicalDevice device, const char *extension);
 	SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device);
 
 	VkInstance instance;
@@ -86,11 +161,34 @@ public:
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 	Window &window;
 	VkCommandPool commandPool;
+	VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+	QueueFamilyIndices queueFamilies;
+	bool dedicatedTransfer = false;
+	// VK_EXT_pipeline_creation_feedback is optional, it only feeds the pipeline cache statistics.
+	bool creationFeedback = false;
+	ExtendedDynamicState dynamicState;
 
 	VkDevice device_;
-	VkSurfaceKHR surface_;
+	std::unique_ptr<VulkanAllocator> allocator;
+	std::unique_ptr<VulkanStagingRing> stagingRing;
+	std::unique_ptr<VulkanLayoutCache> layoutCache;
+	std::unique_ptr<VulkanPipelineCache> pipelineCache;
+	std::unique_ptr<VulkanShaderLibrary> shaderLibrary;
+
+	std::deque<PendingUpload> pendingUploads;
+	std::vector<VkFence> freeFences;
+	std::vector<VkSemaphore> freeSemaphores;
+	uint64_t submittedUploads = 0;
+	uint64_t completedUploads = 0;
+
+	VkSemaphore frameTimeline = VK_NULL_HANDLE;
+	uint64_t submittedFrames = 0;
+	uint64_t completedFrames = 0;
+	std::chrono::steady_clock::duration stallTime{};
+	VkSurfaceKHR surface_ = VK_NULL_HANDLE;
 	VkQueue graphicsQueue_;
 	VkQueue presentQueue_;
+	VkQueue transferQueue_;
 
 	const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};
 	const std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
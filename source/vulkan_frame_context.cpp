@@ -0,0 +1,129 @@
+#include "vulkan_frame_context.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+
+namespace {
+	VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+
+
+VulkanFrameContext::VulkanFrameContext(VulkanDevice &device, uint32_t workerCount, VkDeviceSize scratchSize)
+: device{device}, workers(std::max<uint32_t>(workerCount, 1))
+{
+	commandPool = CreateCommandPool();
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+	if(vkAllocateCommandBuffers(device.Device(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate command buffers!");
+
+	// Every worker gets its own pool, command pools must not be used from several threads at once.
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	for(Worker &worker : workers)
+	{
+		worker.commandPool = CreateCommandPool();
+		allocInfo.commandPool = worker.commandPool;
+		if(vkAllocateCommandBuffers(device.Device(), &allocInfo, &worker.commandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate secondary command buffer!");
+	}
+
+	descriptorPool = VulkanDescriptorPool::Builder(device)
+		.SetMaxSets(DESCRIPTOR_SETS)
+		.AddPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, DESCRIPTOR_SETS)
+		.AddPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, DESCRIPTOR_SETS)
+		.AddPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, DESCRIPTOR_SETS)
+		.Build();
+
+	AddScratchBuffer(scratchSize);
+}
+
+
+
+VulkanFrameContext::~VulkanFrameContext()
+{
+	device.WaitForFrame(lastFrame);
+
+	// Destroying a pool frees its command buffers as well.
+	for(Worker &worker : workers)
+		vkDestroyCommandPool(device.Device(), worker.commandPool, nullptr);
+	vkDestroyCommandPool(device.Device(), commandPool, nullptr);
+}
+
+
+
+void VulkanFrameContext::Begin()
+{
+	device.WaitForFrame(lastFrame);
+
+	vkResetCommandPool(device.Device(), commandPool, 0);
+	for(Worker &worker : workers)
+		vkResetCommandPool(device.Device(), worker.commandPool, 0);
+	descriptorPool->ResetPool();
+
+	// If the scratch memory overflowed last time, replace it with a single buffer that fits all of it.
+	if(scratchBuffers.size() > 1)
+	{
+		VkDeviceSize total = 0;
+		for(const auto &buffer : scratchBuffers)
+			total += buffer->GetBufferSize();
+		scratchBuffers.clear();
+		AddScratchBuffer(total);
+	}
+	scratchHead = 0;
+}
+
+
+
+VulkanStagingRegion VulkanFrameContext::AllocateScratch(VkDeviceSize size, VkDeviceSize alignment)
+{
+	std::lock_guard<std::mutex> lock(scratchMutex);
+
+	VkDeviceSize offset = AlignUp(scratchHead, alignment);
+	if(offset + size > scratchBuffers.back()->GetBufferSize())
+	{
+		AddScratchBuffer(std::max(size, scratchBuffers.back()->GetBufferSize()));
+		offset = 0;
+	}
+	scratchHead = offset + size;
+
+	VulkanBuffer &buffer = *scratchBuffers.back();
+	return {buffer.GetBuffer(), offset, size, static_cast<char *>(buffer.GetMappedMemory()) + offset};
+}
+
+
+
+VkCommandPool VulkanFrameContext::CreateCommandPool()
+{
+	// No RESET_COMMAND_BUFFER_BIT, the pools are only ever reset as a whole.
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = device.FindPhysicalQueueFamilies().graphicsFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkCommandPool pool;
+	if(vkCreateCommandPool(device.Device(), &poolInfo, nullptr, &pool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create frame command pool!");
+	return pool;
+}
+
+
+
+void VulkanFrameContext::AddScratchBuffer(VkDeviceSize size)
+{
+	auto buffer = std::make_unique<VulkanBuffer>(device, size, 1,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	buffer->Map();
+	scratchBuffers.emplace_back(std::move(buffer));
+	scratchHead = 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "vulkan_buffer.h"
+#include "vulkan_descriptors.h"
+#include "vulkan_device.h"
+#include "vulkan_staging_ring.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Everything a single frame in flight records into or allocates from. Nothing is freed individually,
+// Begin() waits for the frame that used the context last and then resets all pools at once.
+class VulkanFrameContext {
+public:
+	static constexpr VkDeviceSize DEFAULT_SCRATCH_SIZE = 4 * 1024 * 1024;
+	static constexpr uint32_t DESCRIPTOR_SETS = 256;
+
+	// workerCount is the number of secondary command buffers that can be recorded in parallel.
+	VulkanFrameContext(VulkanDevice &device, uint32_t workerCount, VkDeviceSize scratchSize = DEFAULT_SCRATCH_SIZE);
+	~VulkanFrameContext();
+
+	VulkanFrameContext(const VulkanFrameContext &) = delete;
+	VulkanFrameContext &operator=(const VulkanFrameContext &) = delete;
+
+	void Begin();
+	// The frame number on the device's frame timeline that the recorded commands were submitted with.
+	void MarkSubmitted(uint64_t frame) { lastFrame = frame; }
+
+	VkCommandBuffer GetCommandBuffer() const { return commandBuffer; }
+	VkCommandBuffer GetSecondaryCommandBuffer(size_t worker) const { return workers[worker].commandBuffer; }
+	size_t GetWorkerCount() const { return workers.size(); }
+	VulkanDescriptorPool &DescriptorPool() { return *descriptorPool; }
+
+	// Host visible memory that is valid until the frame has completed, for per frame vertex and instance data.
+	// May be called from several recording threads at once.
+	VulkanStagingRegion AllocateScratch(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+private:
+	struct Worker {
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	};
+
+	VkCommandPool CreateCommandPool();
+	void AddScratchBuffer(VkDeviceSize size);
+
+	VulkanDevice &device;
+	uint64_t lastFrame = 0;
+
+	VkCommandPool commandPool;
+	VkCommandBuffer commandBuffer;
+	std::vector<Worker> workers;
+	std::unique_ptr<VulkanDescriptorPool> descriptorPool;
+
+	// The last buffer is the one being filled, earlier ones overflowed during this frame.
+	std::vector<std::unique_ptr<VulkanBuffer>> scratchBuffers;
+	VkDeviceSize scratchHead = 0;
+	std::mutex scratchMutex;
+};
@@ -0,0 +1,88 @@
+#include "vulkan_geometry_arena.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <string>
+
+
+
+VulkanGeometryArena::VulkanGeometryArena(VulkanDevice &device, VkDeviceSize vertexBlockSize, VkDeviceSize indexBlockSize)
+: device{device}, vertexBlockSize{vertexBlockSize}, indexBlockSize{indexBlockSize}
+{
+}
+
+
+
+VulkanGeometryArena::Range VulkanGeometryArena::AddVertices(VulkanUploadBatch &uploads, const void *vertices, uint32_t vertexCount,
+	uint32_t stride)
+{
+	VkDeviceSize size = static_cast<VkDeviceSize>(vertexCount) * stride;
+	// The offset has to be a whole number of vertices, so that it can be passed as the first vertex.
+	VkDeviceSize offset = Allocate(vertexBlocks, size, stride, vertexBlockSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+
+	VulkanStagingRegion staging = uploads.Stage(vertices, size, sizeof(float));
+	uploads.CopyConcurrentBuffer(staging.buffer, vertexBlocks.back().buffer->GetBuffer(), size, staging.offset, offset);
+
+	return {static_cast<uint32_t>(vertexBlocks.size() - 1), static_cast<uint32_t>(offset / stride)};
+}
+
+
+
+VulkanGeometryArena::Range VulkanGeometryArena::AddIndices(VulkanUploadBatch &uploads, const void *indices, uint32_t indexCount,
+	VkIndexType indexType)
+{
+	VkDeviceSize indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	VkDeviceSize size = indexCount * indexSize;
+	VkDeviceSize offset = Allocate(indexBlocks, size, indexSize, indexBlockSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+	VulkanStagingRegion staging = uploads.Stage(indices, size, sizeof(uint32_t));
+	uploads.CopyConcurrentBuffer(staging.buffer, indexBlocks.back().buffer->GetBuffer(), size, staging.offset, offset);
+
+	return {static_cast<uint32_t>(indexBlocks.size() - 1), static_cast<uint32_t>(offset / indexSize)};
+}
+
+
+
+void VulkanGeometryArena::LogStats() const
+{
+	auto logBlocks = [](const std::string &name, const std::vector<Block> &blocks)
+	{
+		VkDeviceSize used = 0;
+		VkDeviceSize total = 0;
+		for(const Block &block : blocks)
+		{
+			used += block.head;
+			total += block.buffer->GetBufferSize();
+		}
+		Logger::Status("Geometry arena " + name + ": " + std::to_string(blocks.size()) + " blocks, "
+			+ std::to_string(used / 1024) + " / " + std::to_string(total / 1024) + " KiB used");
+	};
+	logBlocks("vertices", vertexBlocks);
+	logBlocks("indices", indexBlocks);
+}
+
+
+
+VkDeviceSize VulkanGeometryArena::Allocate(std::vector<Block> &blocks, VkDeviceSize size, VkDeviceSize alignment,
+	VkDeviceSize blockSize, VkBufferUsageFlags usage)
+{
+	if(!blocks.empty())
+	{
+		Block &block = blocks.back();
+		VkDeviceSize offset = (block.head + alignment - 1) / alignment * alignment;
+		if(offset + size <= block.buffer->GetBufferSize())
+		{
+			block.head = offset + size;
+			return offset;
+		}
+	}
+
+	// Earlier blocks keep their free tail, static geometry is usually loaded in one go and rarely fills a block.
+	Block block;
+	block.buffer = std::make_unique<VulkanBuffer>(device, std::max(size, blockSize), 1,
+		usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, true);
+	block.head = size;
+	blocks.push_back(std::move(block));
+	return 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "vulkan_buffer.h"
+#include "vulkan_device.h"
+#include "vulkan_upload_batch.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Vertex and index data of all static models, sub-allocated from a few large device local buffers.
+// Nothing is freed before the arena itself. Models in the same block share their buffer bindings
+// and only differ in the first vertex and first index of their draws.
+class VulkanGeometryArena {
+public:
+	static constexpr VkDeviceSize DEFAULT_VERTEX_BLOCK_SIZE = 16 * 1024 * 1024;
+	static constexpr VkDeviceSize DEFAULT_INDEX_BLOCK_SIZE = 4 * 1024 * 1024;
+
+	struct Range {
+		uint32_t block;
+		// In vertices or indices, relative to the start of the block.
+		uint32_t first;
+	};
+
+	VulkanGeometryArena(VulkanDevice &device, VkDeviceSize vertexBlockSize = DEFAULT_VERTEX_BLOCK_SIZE,
+		VkDeviceSize indexBlockSize = DEFAULT_INDEX_BLOCK_SIZE);
+
+	VulkanGeometryArena(const VulkanGeometryArena &) = delete;
+	VulkanGeometryArena &operator=(const VulkanGeometryArena &) = delete;
+
+	// Records the copy of vertexCount vertices of the given stride into the batch.
+	Range AddVertices(VulkanUploadBatch &uploads, const void *vertices, uint32_t vertexCount, uint32_t stride);
+	// 16 and 32 bit indices share the index blocks, a change of the index type needs a new index buffer binding.
+	Range AddIndices(VulkanUploadBatch &uploads, const void *indices, uint32_t indexCount, VkIndexType indexType);
+
+	// Both are bound at offset 0, ranges are addressed through the draw parameters.
+	VkBuffer GetVertexBuffer(uint32_t block) const { return vertexBlocks[block].buffer->GetBuffer(); }
+	VkBuffer GetIndexBuffer(uint32_t block) const { return indexBlocks[block].buffer->GetBuffer(); }
+
+	void LogStats() const;
+
+private:
+	struct Block {
+		std::unique_ptr<VulkanBuffer> buffer;
+		VkDeviceSize head = 0;
+	};
+
+	// Returns the byte offset of the range, adding a block if the last one is full.
+	VkDeviceSize Allocate(std::vector<Block> &blocks, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize blockSize,
+		VkBufferUsageFlags usage);
+
+	VulkanDevice &device;
+	VkDeviceSize vertexBlockSize;
+	VkDeviceSize indexBlockSize;
+
+	std::vector<Block> vertexBlocks;
+	std::vector<Block> indexBlocks;
+};
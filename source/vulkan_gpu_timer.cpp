@@ -0,0 +1,76 @@
+#include "vulkan_gpu_timer.h"
+
+#include <stdexcept>
+
+
+
+VulkanGpuTimer::VulkanGpuTimer(VulkanDevice &device, uint32_t slotCount)
+: device(device), pending(slotCount, false)
+{
+	const QueueFamilyIndices &indices = device.FindPhysicalQueueFamilies();
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device.GetPhysicalDevice(), &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device.GetPhysicalDevice(), &queueFamilyCount, queueFamilies.data());
+
+	validBits = queueFamilies[indices.graphicsFamily].timestampValidBits;
+	period = device.properties.limits.timestampPeriod;
+	if(!IsSupported())
+		return;
+
+	VkQueryPoolCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	createInfo.queryCount = 2 * slotCount;
+
+	if(vkCreateQueryPool(device.Device(), &createInfo, nullptr, &queryPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create timestamp query pool!");
+}
+
+
+
+VulkanGpuTimer::~VulkanGpuTimer()
+{
+	vkDestroyQueryPool(device.Device(), queryPool, nullptr);
+}
+
+
+
+void VulkanGpuTimer::Begin(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+	if(!IsSupported())
+		return;
+	vkCmdResetQueryPool(commandBuffer, queryPool, 2 * slot, 2);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 2 * slot);
+}
+
+
+
+void VulkanGpuTimer::End(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+	if(!IsSupported())
+		return;
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * slot + 1);
+	pending[slot] = true;
+}
+
+
+
+bool VulkanGpuTimer::Read(uint32_t slot, double &milliseconds)
+{
+	if(!pending[slot])
+		return false;
+
+	uint64_t timestamps[2];
+	if(vkGetQueryPoolResults(device.Device(), queryPool, 2 * slot, 2, sizeof(timestamps), timestamps,
+			sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return false;
+	pending[slot] = false;
+
+	// Only the low validBits bits count, the difference is taken modulo that range in case the counter wrapped.
+	uint64_t ticks = timestamps[1] - timestamps[0];
+	if(validBits < 64)
+		ticks &= (uint64_t(1) << validBits) - 1;
+	milliseconds = ticks * period / 1e6;
+	return true;
+}
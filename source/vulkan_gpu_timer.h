@@ -0,0 +1,37 @@
+#pragma once
+
+#include "vulkan_device.h"
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Measures how long the GPU spends on each frame with a timestamp at the start and end of its command buffer.
+// There is a pair of queries per frame slot, a slot's result is read once the frame using it has completed.
+class VulkanGpuTimer {
+public:
+	VulkanGpuTimer(VulkanDevice &device, uint32_t slotCount);
+	~VulkanGpuTimer();
+
+	VulkanGpuTimer(const VulkanGpuTimer &) = delete;
+	VulkanGpuTimer &operator=(const VulkanGpuTimer &) = delete;
+
+	// False if the graphics queue does not support timestamps, Begin() and End() do nothing then.
+	bool IsSupported() const { return validBits != 0; }
+
+	// Recorded outside of render passes, first and last thing in the frame's command buffer.
+	void Begin(VkCommandBuffer commandBuffer, uint32_t slot);
+	void End(VkCommandBuffer commandBuffer, uint32_t slot);
+	// Returns the slot's last measured time once, if its frame has completed. Does not block.
+	bool Read(uint32_t slot, double &milliseconds);
+
+private:
+	VulkanDevice &device;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	uint32_t validBits = 0;
+	// Nanoseconds per timestamp tick.
+	double period = 0.;
+	std::vector<bool> pending;
+};
@@ -0,0 +1,87 @@
+#include "vulkan_layout_cache.h"
+
+#include "logger.h"
+
+#include <stdexcept>
+#include <string>
+
+
+
+VulkanLayoutCache::VulkanLayoutCache(VulkanDevice &device)
+: device{device}
+{
+}
+
+
+
+VulkanLayoutCache::~VulkanLayoutCache()
+{
+	for(auto &it : pipelineLayouts)
+		vkDestroyPipelineLayout(device.Device(), it.second, nullptr);
+}
+
+
+
+VulkanDescriptorSetLayout &VulkanLayoutCache::GetDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding> &bindings)
+{
+	std::vector<uint32_t> key;
+	for(const VkDescriptorSetLayoutBinding &binding : bindings)
+		key.insert(key.end(), {binding.binding, static_cast<uint32_t>(binding.descriptorType), binding.descriptorCount,
+			binding.stageFlags});
+
+	std::lock_guard<std::mutex> lock(mutex);
+	setLayoutRequests++;
+	std::unique_ptr<VulkanDescriptorSetLayout> &layout = setLayouts[key];
+	if(!layout)
+	{
+		VulkanDescriptorSetLayout::Builder builder(device);
+		for(const VkDescriptorSetLayoutBinding &binding : bindings)
+			builder.AddBinding(binding.binding, binding.descriptorType, binding.stageFlags, binding.descriptorCount);
+		layout = builder.Build();
+	}
+	return *layout;
+}
+
+
+
+VkPipelineLayout VulkanLayoutCache::GetPipelineLayout(const std::vector<VkDescriptorSetLayout> &setLayouts,
+	const std::vector<VkPushConstantRange> &pushConstantRanges)
+{
+	// Set layouts are never destroyed before the cache, so their handles identify them.
+	std::vector<uint64_t> key;
+	for(VkDescriptorSetLayout setLayout : setLayouts)
+		key.push_back(reinterpret_cast<uint64_t>(setLayout));
+	for(const VkPushConstantRange &range : pushConstantRanges)
+		key.insert(key.end(), {range.stageFlags, range.offset, range.size});
+	// Tells apart the set count, so that ranges cannot be mistaken for set layouts.
+	key.push_back(setLayouts.size());
+
+	std::lock_guard<std::mutex> lock(mutex);
+	pipelineLayoutRequests++;
+	auto it = pipelineLayouts.find(key);
+	if(it != pipelineLayouts.end())
+		return it->second;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+	pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
+	VkPipelineLayout pipelineLayout;
+	if(vkCreatePipelineLayout(device.Device(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create pipeline layout!");
+	pipelineLayouts.emplace(key, pipelineLayout);
+	return pipelineLayout;
+}
+
+
+
+void VulkanLayoutCache::LogStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Logger::Status("Layout cache: " + std::to_string(setLayouts.size()) + " set layouts for "
+		+ std::to_string(setLayoutRequests) + " requests, " + std::to_string(pipelineLayouts.size())
+		+ " pipeline layouts for " + std::to_string(pipelineLayoutRequests) + " requests");
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "vulkan_descriptors.h"
+#include "vulkan_device.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Descriptor set and pipeline layouts, shared by every pipeline that asks for the same description.
+// They live as long as the device, so recreating a pipeline never recreates its layout and pipelines
+// with equal layouts can keep their descriptor sets bound across a pipeline switch.
+class VulkanLayoutCache {
+public:
+	explicit VulkanLayoutCache(VulkanDevice &device);
+	~VulkanLayoutCache();
+
+	VulkanLayoutCache(const VulkanLayoutCache &) = delete;
+	VulkanLayoutCache &operator=(const VulkanLayoutCache &) = delete;
+
+	// Bindings without binding flags. Runtime sized arrays need those, so their sets are owned elsewhere.
+	VulkanDescriptorSetLayout &GetDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding> &bindings);
+	VkPipelineLayout GetPipelineLayout(const std::vector<VkDescriptorSetLayout> &setLayouts,
+		const std::vector<VkPushConstantRange> &pushConstantRanges);
+
+	void LogStats();
+
+private:
+	VulkanDevice &device;
+
+	std::mutex mutex;
+	std::map<std::vector<uint32_t>, std::unique_ptr<VulkanDescriptorSetLayout>> setLayouts;
+	std::map<std::vector<uint64_t>, VkPipelineLayout> pipelineLayouts;
+	uint32_t setLayoutRequests = 0;
+	uint32_t pipelineLayoutRequests = 0;
+};
@@ -1,68 +1,208 @@
 #include "vulkan_model.h"
 #include "es_vulkan.h"
 #include "logger.h"
-#include "vulkan_buffer.h"
+#include "mesh_optimizer.h"
+#include "vulkan_upload_batch.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
-#include <memory>
+#include <limits>
+#include <numeric>
 #include <string>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
 
 
-VulkanModel::VulkanModel(VulkanDevice &device, const std::vector<float> &vertices, const std::vector<AttributeSize> &attributeDescriptors)
-: device(device), attributeDescriptors(attributeDescriptors)
+namespace {
+	// Round to nearest even, with overflow to infinity and underflow to half denormals or zero.
+	uint16_t FloatToHalf(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		uint32_t sign = (bits >> 16) & 0x8000;
+		uint32_t exponent = (bits >> 23) & 0xff;
+		uint32_t mantissa = bits & 0x7fffff;
+
+		if(exponent == 0xff)
+			return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+		int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+		if(halfExponent >= 0x1f)
+			return static_cast<uint16_t>(sign | 0x7c00);
+		if(halfExponent <= 0)
+		{
+			if(halfExponent < -10)
+				return static_cast<uint16_t>(sign);
+			// Denormal, shift the mantissa including its implicit leading one into place.
+			mantissa |= 0x800000;
+			uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+			uint32_t half = mantissa >> shift;
+			uint32_t rest = mantissa & ((1u << shift) - 1);
+			uint32_t halfway = 1u << (shift - 1);
+			if(rest > halfway || (rest == halfway && (half & 1)))
+				half++;
+			return static_cast<uint16_t>(sign | half);
+		}
+
+		uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+		uint32_t rest = mantissa & 0x1fff;
+		// A carry out of the mantissa correctly bumps the exponent, up to infinity.
+		if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+			half++;
+		return static_cast<uint16_t>(sign | half);
+	}
+
+
+
+	template <class T>
+	T Normalize(float value, float minimum, float scale)
+	{
+		return static_cast<T>(std::lround(std::clamp(value, minimum, 1.0f) * scale));
+	}
+
+
+
+	// Converts one vertex from its float input into the attribute formats.
+	void PackVertex(const std::vector<AttributeSize> &attributeDescriptors, const float *input, char *output)
+	{
+		for(const auto &attributeDescriptor : attributeDescriptors)
+		{
+			size_t components = EsToVulkan::ComponentCount(attributeDescriptor);
+			switch(attributeDescriptor)
+			{
+				case AttributeSize::HALF_TWO:
+				case AttributeSize::HALF_FOUR:
+					for(size_t i = 0; i < components; i++)
+					{
+						uint16_t half = FloatToHalf(input[i]);
+						memcpy(output + i * sizeof(half), &half, sizeof(half));
+					}
+					break;
+				case AttributeSize::UNORM16_TWO:
+				case AttributeSize::UNORM16_FOUR:
+					for(size_t i = 0; i < components; i++)
+					{
+						uint16_t unorm = Normalize<uint16_t>(input[i], 0.0f, 65535.0f);
+						memcpy(output + i * sizeof(unorm), &unorm, sizeof(unorm));
+					}
+					break;
+				case AttributeSize::SNORM16_TWO:
+				case AttributeSize::SNORM16_FOUR:
+					for(size_t i = 0; i < components; i++)
+					{
+						int16_t snorm = Normalize<int16_t>(input[i], -1.0f, 32767.0f);
+						memcpy(output + i * sizeof(snorm), &snorm, sizeof(snorm));
+					}
+					break;
+				case AttributeSize::UNORM8_FOUR:
+					for(size_t i = 0; i < components; i++)
+						output[i] = static_cast<char>(Normalize<uint8_t>(input[i], 0.0f, 255.0f));
+					break;
+				default:
+					memcpy(output, input, components * sizeof(float));
+					break;
+			}
+			input += components;
+			output += EsToVulkan::ByteSize(attributeDescriptor);
+		}
+	}
+}
+
+
+
+VulkanModel::VulkanModel(VulkanGeometryArena &arena, VulkanUploadBatch &uploads, const std::vector<float> &vertices,
+	const std::vector<AttributeSize> &attributeDescriptors, const std::vector<uint32_t> &indices)
+: arena(&arena)
 {
-	CreateVertexBuffers(vertices);
+	Load(uploads, vertices, attributeDescriptors, indices);
 }
 
 
 
-VulkanModel::~VulkanModel() { }
+VulkanModel::VulkanModel(VulkanGeometryArena &arena, VulkanUploadBatch &uploads, const std::vector<float> &vertices,
+	const std::vector<AttributeSize> &attributeDescriptors, const std::vector<uint16_t> &indices)
+: arena(&arena)
+{
+	Load(uploads, vertices, attributeDescriptors, std::vector<uint32_t>(indices.begin(), indices.end()));
+}
 
 
 
-void VulkanModel::Bind(VkCommandBuffer commandBuffer)
+void VulkanModel::Bind(VkCommandBuffer commandBuffer) const
 {
-	VkBuffer buffers[] = {vertexBuffer->GetBuffer()};
+	VkBuffer buffers[] = {GetVertexBuffer()};
 	VkDeviceSize offsets[] = {0};
 	vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, GetIndexBuffer(), 0, indexType);
 }
 
 
 
-void VulkanModel::Draw(VkCommandBuffer commandBuffer)
+void VulkanModel::Draw(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint32_t firstInstance) const
 {
-	vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+	vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, static_cast<int32_t>(firstVertex), firstInstance);
 }
 
 
 
-void VulkanModel::CreateVertexBuffers(const std::vector<float> &vertices)
+void VulkanModel::Load(VulkanUploadBatch &uploads, std::vector<float> vertices, const std::vector<AttributeSize> &attributeDescriptors,
+	std::vector<uint32_t> indices)
 {
+	// The input is in floats, the vertex buffer in the packed attribute formats.
 	uint32_t sizePerVertex = 0;
+	uint32_t vertexSize = 0;
 	for(const auto &attributeDescriptor : attributeDescriptors)
-		sizePerVertex += EsToVulkan::FORMAT_MAP_SIZE.at(attributeDescriptor);
-
-	vertexCount = static_cast<uint32_t>(vertices.size() / sizePerVertex);
-	assert(vertexCount >= 3 && "vertex count must be at least 3");
-
-	VkDeviceSize bufferSize = sizeof(float) * vertexCount * sizePerVertex;
-	uint32_t vertexSize = sizePerVertex * sizeof(float);
-
-	VulkanBuffer stagingBuffer(device, vertexSize, vertexCount,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	stagingBuffer.Map();
-	stagingBuffer.WriteToBuffer((void *)vertices.data());
-
-	vertexBuffer = std::make_unique<VulkanBuffer>(device, vertexSize, vertexCount,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-	device.CopyBuffer(stagingBuffer.GetBuffer(), vertexBuffer->GetBuffer(), bufferSize);
+	{
+		sizePerVertex += EsToVulkan::ComponentCount(attributeDescriptor);
+		vertexSize += EsToVulkan::ByteSize(attributeDescriptor);
+	}
+
+	uint32_t loadedVertices = static_cast<uint32_t>(vertices.size() / sizePerVertex);
+	assert(loadedVertices >= 3 && "vertex count must be at least 3");
+	if(indices.empty())
+	{
+		indices.resize(loadedVertices);
+		std::iota(indices.begin(), indices.end(), 0);
+	}
+	assert(indices.size() % 3 == 0 && "index count must be a multiple of 3");
+
+	float acmrBefore = MeshOptimizer::ComputeACMR(indices, loadedVertices);
+	vertexCount = MeshOptimizer::DeduplicateVertices(vertices, sizePerVertex, indices);
+	MeshOptimizer::OptimizeVertexCache(indices, vertexCount);
+	vertexCount = MeshOptimizer::OptimizeVertexFetch(vertices, sizePerVertex, indices);
+	float acmrAfter = MeshOptimizer::ComputeACMR(indices, vertexCount);
+
+	std::vector<char> packed(static_cast<size_t>(vertexCount) * vertexSize);
+	for(uint32_t vertex = 0; vertex < vertexCount; vertex++)
+		PackVertex(attributeDescriptors, &vertices[vertex * sizePerVertex], &packed[vertex * vertexSize]);
+
+	VulkanGeometryArena::Range vertexRange = arena->AddVertices(uploads, packed.data(), vertexCount, vertexSize);
+	vertexBlock = vertexRange.block;
+	firstVertex = vertexRange.first;
+
+	indexCount = static_cast<uint32_t>(indices.size());
+	VulkanGeometryArena::Range indexRange;
+	if(vertexCount <= std::numeric_limits<uint16_t>::max() + 1u)
+	{
+		indexType = VK_INDEX_TYPE_UINT16;
+		std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+		indexRange = arena->AddIndices(uploads, shortIndices.data(), indexCount, indexType);
+	}
+	else
+	{
+		indexType = VK_INDEX_TYPE_UINT32;
+		indexRange = arena->AddIndices(uploads, indices.data(), indexCount, indexType);
+	}
+	indexBlock = indexRange.block;
+	firstIndex = indexRange.first;
+
+	Logger::Status("Model: " + std::to_string(loadedVertices) + " -> " + std::to_string(vertexCount) + " vertices of "
+		+ std::to_string(vertexSize) + " bytes (" + std::to_string(sizePerVertex * sizeof(float)) + " unpacked), "
+		+ std::to_string(indexCount / 3) + " triangles, ACMR "
+		+ std::to_string(acmrBefore) + " -> " + std::to_string(acmrAfter) + ", "
+		+ (indexType == VK_INDEX_TYPE_UINT16 ? "16" : "32") + " bit indices");
 }
@@ -1,17 +1,20 @@
 #pragma once
 
 #include "vulkan_device.h"
-#include "vulkan_buffer.h"
+#include "vulkan_geometry_arena.h"
+#include "vulkan_upload_batch.h"
 
 
 #include <cstdint>
 #include <map>
-#include <memory>
 #include <vulkan/vulkan_core.h>
 #include "es_vulkan.h"
 
 
 
+// A static, indexed model's range in the geometry arena. Models are cheap to copy, the arena owns their data.
+// At load time duplicate vertices are merged and triangles and vertices are reordered for the vertex caches,
+// so the draw order of triangles within a model is not preserved.
 class VulkanModel {
 public:
 
@@ -19,23 +22,35 @@ public:
 	std::vector<VkVertexInputAttributeDescription> GetAttributeDescriptions() const;
 
 
-	VulkanModel(VulkanDevice &device, const std::vector<float> &vertices, const std::vector<AttributeSize> &attributeDescriptors);
-	~VulkanModel();
+	// Without indices the vertices are taken as a triangle list in order.
+	VulkanModel(VulkanGeometryArena &arena, VulkanUploadBatch &uploads, const std::vector<float> &vertices,
+		const std::vector<AttributeSize> &attributeDescriptors, const std::vector<uint32_t> &indices = {});
+	VulkanModel(VulkanGeometryArena &arena, VulkanUploadBatch &uploads, const std::vector<float> &vertices,
+		const std::vector<AttributeSize> &attributeDescriptors, const std::vector<uint16_t> &indices);
 
-	VulkanModel(const VulkanModel &) = delete;
-	VulkanModel operator=(const VulkanModel &) = delete;
-	VulkanModel(VulkanModel &&) = delete;
-	VulkanModel &operator=(VulkanModel &&) = delete;
+	// Binds the arena blocks holding the model, which stay valid for every other model in the same blocks.
+	void Bind(VkCommandBuffer commandBuffer) const;
+	void Draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1, uint32_t firstInstance = 0) const;
 
-	void Bind(VkCommandBuffer commandBuffer);
-	void Draw(VkCommandBuffer commandBuffer);
+	VkBuffer GetVertexBuffer() const { return arena->GetVertexBuffer(vertexBlock); }
+	VkBuffer GetIndexBuffer() const { return arena->GetIndexBuffer(indexBlock); }
+	// 16 bit whenever the vertex count allows it.
+	VkIndexType GetIndexType() const { return indexType; }
+	uint32_t GetFirstVertex() const { return firstVertex; }
+	uint32_t GetVertexCount() const { return vertexCount; }
+	uint32_t GetFirstIndex() const { return firstIndex; }
+	uint32_t GetIndexCount() const { return indexCount; }
 
 private:
-	void CreateVertexBuffers(const std::vector<float> &vertices);
-
-	VulkanDevice &device;
-	std::unique_ptr<VulkanBuffer> vertexBuffer;
-	uint32_t vertexCount;
-
-	const std::vector<AttributeSize> attributeDescriptors;
+	void Load(VulkanUploadBatch &uploads, std::vector<float> vertices, const std::vector<AttributeSize> &attributeDescriptors,
+		std::vector<uint32_t> indices);
+
+	VulkanGeometryArena *arena;
+	uint32_t vertexBlock = 0;
+	uint32_t firstVertex = 0;
+	uint32_t vertexCount = 0;
+	uint32_t indexBlock = 0;
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
 };
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "vulkan_parallel_recorder.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+
+
+VulkanParallelRecorder::VulkanParallelRecorder(ThreadPool &threadPool)
+: threadPool{threadPool}
+{
+}
+
+
+
+void VulkanParallelRecorder::Record(VulkanFrameContext &frame, const VkRenderPassBeginInfo &renderPassInfo, size_t drawCount,
+	const RecordFunction &record)
+{
+	VkCommandBuffer primary = frame.GetCommandBuffer();
+	size_t chunkCount = std::min(frame.GetWorkerCount(), std::max<size_t>(1, drawCount / MIN_DRAWS_PER_CHUNK));
+
+	vkCmdBeginRenderPass(primary, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderPassInfo.renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = renderPassInfo.framebuffer;
+
+	threadPool.ParallelFor(drawCount, chunkCount, [&](size_t chunk, size_t begin, size_t end)
+	{
+		VkCommandBuffer commandBuffer = frame.GetSecondaryCommandBuffer(chunk);
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+		if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+			throw std::runtime_error("failed to begin recording secondary command buffer!");
+
+		record(commandBuffer, begin, end);
+
+		if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to record secondary command buffer!");
+	});
+
+	std::vector<VkCommandBuffer> commandBuffers(chunkCount);
+	for(size_t i = 0; i < chunkCount; i++)
+		commandBuffers[i] = frame.GetSecondaryCommandBuffer(i);
+	vkCmdExecuteCommands(primary, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+
+	vkCmdEndRenderPass(primary);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "thread_pool.h"
+#include "vulkan_frame_context.h"
+
+#include <cstddef>
+#include <functional>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Splits a render pass' draw list across the thread pool. Every chunk records into one of the frame context's
+// secondary command buffers, and the primary command buffer executes them in draw order.
+class VulkanParallelRecorder {
+public:
+	// Chunks smaller than this cost more in command buffer overhead than they save in recording time.
+	static constexpr size_t MIN_DRAWS_PER_CHUNK = 256;
+
+	// Records draws [begin, end) into a secondary command buffer that already continues the render pass.
+	// Secondary command buffers inherit no state, so the callback binds everything it needs itself.
+	using RecordFunction = std::function<void(VkCommandBuffer commandBuffer, size_t begin, size_t end)>;
+
+	VulkanParallelRecorder(ThreadPool &threadPool);
+
+	VulkanParallelRecorder(const VulkanParallelRecorder &) = delete;
+	VulkanParallelRecorder &operator=(const VulkanParallelRecorder &) = delete;
+
+	// Begins the render pass on the frame's primary command buffer, records drawCount draws in parallel and ends it again.
+	// The frame context must have been begun.
+	void Record(VulkanFrameContext &frame, const VkRenderPassBeginInfo &renderPassInfo, size_t drawCount, const RecordFunction &record);
+
+	// The calling thread records the first chunk, so there can be one more chunk than workers.
+	uint32_t GetMaxChunkCount() const { return threadPool.GetThreadCount() + 1; }
+
+private:
+	ThreadPool &threadPool;
+};
@@ -1,50 +1,175 @@
 #include "vulkan_pipeline.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
-#include <fstream>
-#include <ios>
+#include <map>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 #include <vulkan/vulkan_core.h>
-#include <numeric>
 
 #include "logger.h"
 #include "es_vulkan.h"
-#include "source/vulkan_swapchain.h"
+#include "spirv_reflection.h"
 #include "vulkan_device.h"
+#include "vulkan_layout_cache.h"
+#include "vulkan_pipeline_cache.h"
+#include "vulkan_shader_library.h"
 #include "vulkan_model.h"
 
 
 
-std::vector<uint32_t> VulkanShaderInfo::GetDynamicOffsets(uint imageIndex, uint numElements)
-{
-	uint32_t alignmentSize = uniformBuffer->GetAlignmentSize();
-	std::vector<uint32_t> offsets;
-	uint realNumElements = std::max(numElements, uniformBuffer->GetInstanceCount() / VulkanSwapChain::MAX_FRAMES_IN_FLIGHT);
-	for(uint i = 0; i < realNumElements; i++)
-		offsets.emplace_back(alignmentSize * (40 * imageIndex + i));
+namespace {
+	// Attribute layouts only describe float inputs. The float formats are numbered by their component count.
+	AttributeSize FloatAttribute(uint32_t componentCount)
+	{
+		return static_cast<AttributeSize>(componentCount);
+	}
+
+
+
+	void ResolveVertexInputs(const SpirvReflection &reflection, ShaderInfo &inputInfo)
+	{
+		const std::vector<SpirvReflection::Input> &inputs = reflection.GetInputs();
+		std::vector<AttributeSize> declared = inputInfo.attributeLayout;
+		declared.insert(declared.end(), inputInfo.instanceLayout.begin(), inputInfo.instanceLayout.end());
+
+		// Compact formats are a property of the vertex data, not of the shader, so a declared layout wins.
+		// Without one every input is read per vertex as 32 bit floats.
+		bool derive = declared.empty();
+		if(!derive && declared.size() != inputs.size())
+			throw std::runtime_error("vertex layout does not match the shader inputs of " + inputInfo.vertexShaderFilename + "!");
+		for(size_t i = 0; i < inputs.size(); i++)
+		{
+			const SpirvReflection::Input &input = inputs[i];
+			bool matches = input.location == i && input.format == EsToVulkan::Format(FloatAttribute(input.componentCount))
+				&& (derive || EsToVulkan::ComponentCount(declared[i]) == input.componentCount);
+			if(!matches)
+				throw std::runtime_error("vertex layout does not match the shader inputs of " + inputInfo.vertexShaderFilename + "!");
+			if(derive)
+				inputInfo.attributeLayout.push_back(FloatAttribute(input.componentCount));
+		}
+	}
+
+
 
-	return offsets;
+	void CheckBlock(const SpirvReflection::Block &block, const std::vector<AttributeSize> &fields, BlockLayout layout,
+		const std::string &name)
+	{
+		if(fields.empty())
+			return;
+
+		// Also rejects compact formats, which blocks cannot hold.
+		EsToVulkan::BlockSize(fields, layout);
+		bool matches = block.memberOffsets.size() == fields.size();
+		for(size_t i = 0; matches && i < fields.size(); i++)
+			matches = block.memberOffsets[i] == EsToVulkan::FieldOffset(fields.data(), i, layout);
+		if(!matches)
+			throw std::runtime_error(name + " layout does not match the shader!");
+	}
+
+
+
+	// Uniform blocks are fed from a uniform ring, which binds them with a dynamic offset.
+	VkDescriptorType LayoutType(VkDescriptorType type)
+	{
+		return type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : type;
+	}
+
+
+
+	void CheckExternalSet(const VulkanDescriptorSetLayout &setLayout, const SpirvReflection::Binding &binding)
+	{
+		const VkDescriptorSetLayoutBinding *layoutBinding = setLayout.FindBinding(binding.binding);
+		bool matches = layoutBinding
+			&& (layoutBinding->descriptorType == binding.type || layoutBinding->descriptorType == LayoutType(binding.type))
+			&& layoutBinding->descriptorCount >= binding.count
+			&& (layoutBinding->stageFlags & binding.stages) == binding.stages;
+		if(!matches)
+			throw std::runtime_error("descriptor set " + std::to_string(binding.set) + " binding "
+				+ std::to_string(binding.binding) + " does not match the shader!");
+	}
+
+
+
+	void CheckSpecialization(const SpirvReflection &reflection, const SpecializationConstants &specialization)
+	{
+		const std::vector<SpecializationConstants::Constant> &declared = reflection.GetSpecializationConstants();
+		for(const SpecializationConstants::Constant &constant : specialization.GetConstants())
+		{
+			auto it = std::find_if(declared.begin(), declared.end(),
+				[&constant](const SpecializationConstants::Constant &existing) { return existing.id == constant.id; });
+			if(it == declared.end() || it->type != constant.type)
+				throw std::runtime_error("specialization constant " + std::to_string(constant.id) + " does not match the shader!");
+		}
+	}
+
+
+
+	// Textures are loaded with straight, not premultiplied, alpha.
+	VkColorBlendEquationEXT BlendEquation(BlendMode blend)
+	{
+		switch(blend)
+		{
+			case BlendMode::ALPHA:
+				return {VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA, VK_BLEND_OP_ADD,
+					VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA, VK_BLEND_OP_ADD};
+			case BlendMode::ADDITIVE:
+				return {VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ONE, VK_BLEND_OP_ADD,
+					VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ONE, VK_BLEND_OP_ADD};
+			case BlendMode::SOLID:
+			default:
+				return {VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD,
+					VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD};
+		}
+	}
+
+
+
+	// A dynamic topology has to stay within the class of the pipeline's topology unless the device lifts that.
+	VkPrimitiveTopology TopologyClass(VkPrimitiveTopology topology)
+	{
+		switch(topology)
+		{
+			case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+				return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+			case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+			case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+			case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+			case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+				return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+			case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST:
+				return VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+			default:
+				return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		}
+	}
 }
 
 
 
-VulkanPipeline::VulkanPipeline(VulkanDevice &device, const std::string &vertFilePath, const std::string &fragFilePath,
-	const VulkanPipelineConfigInfo &configInfo, const std::vector<AttributeSize> &attributeDescriptors)
+VulkanPipeline::VulkanPipeline(VulkanDevice &device, const VulkanShaderLibrary::Shader &vertShader,
+	const VulkanShaderLibrary::Shader &fragShader, const VulkanPipelineConfigInfo &configInfo,
+	const std::vector<AttributeSize> &attributeDescriptors,
+	const std::vector<AttributeSize> &instanceDescriptors, const SpecializationConstants &specialization)
 : device(device)
 {
-	CreateGraphicsPipeline(vertFilePath, fragFilePath, configInfo, attributeDescriptors);
+	CreateGraphicsPipeline(vertShader, fragShader, configInfo, attributeDescriptors, instanceDescriptors, specialization);
+
+	const std::vector<VkDynamicState> &dynamicStates = configInfo.dynamicStateEnables;
+	dynamicRasterState = std::find(dynamicStates.begin(), dynamicStates.end(), VK_DYNAMIC_STATE_CULL_MODE_EXT) != dynamicStates.end();
+	dynamicBlendState = std::find(dynamicStates.begin(), dynamicStates.end(), VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT)
+		!= dynamicStates.end();
 }
 
 
 
 VulkanPipeline::~VulkanPipeline()
 {
-	vkDestroyShaderModule(device.Device(), vertShaderModule, nullptr);
-	vkDestroyShaderModule(device.Device(), fragShaderModule, nullptr);
 	vkDestroyPipeline(device.Device(), graphicsPipeline, nullptr);
 }
 
@@ -57,6 +182,37 @@ void VulkanPipeline::Bind(VkCommandBuffer commandBuffer)
 
 
 
+void VulkanPipeline::SetDynamicState(VkCommandBuffer commandBuffer, const VulkanRenderState &state) const
+{
+	const ExtendedDynamicState &dynamicState = device.DynamicState();
+	if(dynamicRasterState)
+	{
+		dynamicState.setPrimitiveTopology(commandBuffer, state.topology);
+		dynamicState.setCullMode(commandBuffer, state.cullMode);
+		dynamicState.setFrontFace(commandBuffer, state.frontFace);
+		dynamicState.setDepthTestEnable(commandBuffer, state.depthTest);
+		dynamicState.setDepthWriteEnable(commandBuffer, state.depthWrite);
+	}
+	if(dynamicBlendState)
+	{
+		VkBool32 blendEnable = state.blend != BlendMode::SOLID;
+		VkColorBlendEquationEXT equation = BlendEquation(state.blend);
+		dynamicState.setColorBlendEnable(commandBuffer, 0, 1, &blendEnable);
+		dynamicState.setColorBlendEquation(commandBuffer, 0, 1, &equation);
+	}
+}
+
+
+
+void VulkanPipeline::PushConstants(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, const VulkanShaderInfo &shaderInfo,
+	const void *data, uint32_t size)
+{
+	assert(size <= shaderInfo.pushConstantSize && "Push constant data larger than the declared block.");
+	vkCmdPushConstants(commandBuffer, pipelineLayout, shaderInfo.pushConstantStages, 0, size, data);
+}
+
+
+
 void VulkanPipeline::DefaultPipelineConfigInfo(VulkanPipelineConfigInfo &configInfo)
 {
 	configInfo.inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -128,87 +284,165 @@ void VulkanPipeline::DefaultPipelineConfigInfo(VulkanPipelineConfigInfo &configI
 
 
 
-VulkanShaderInfo VulkanPipeline::PrepareShaderInfo(VulkanDevice &device, ShaderInfo &inputInfo, const int maxFrames)
+void VulkanPipeline::SetRenderState(const VulkanDevice &device, VulkanPipelineConfigInfo &configInfo, const VulkanRenderState &state)
 {
-	VulkanShaderInfo shaderInfo{
-		.bufferCount = 40
-	};
-
-	uint32_t uniformSize = 0;
-	for(const auto &uniformValue : inputInfo.uniformLayout)
-		uniformSize += EsToVulkan::FORMAT_MAP_TYPE_SIZE.at(uniformValue);
-
-	auto minOffsetAlignment = std::lcm(
-		device.properties.limits.minUniformBufferOffsetAlignment,
-		device.properties.limits.nonCoherentAtomSize);
-
-	shaderInfo.uniformBuffer = std::make_unique<VulkanBuffer>(
-		device,
-		uniformSize,
-		shaderInfo.bufferCount * maxFrames,
-		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-		device.properties.limits.minUniformBufferOffsetAlignment);
-	shaderInfo.uniformBuffer->Map();
-
-
-	shaderInfo.desriptorPool = VulkanDescriptorPool::Builder(device)
-		.SetMaxSets(shaderInfo.bufferCount * maxFrames)
-		.AddPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, shaderInfo.bufferCount * maxFrames)
-		.Build();
-	shaderInfo.desriptorSetLayout = VulkanDescriptorSetLayout::Builder(device)
-		.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT)
-		.Build();
-	for(int i = 0; i < maxFrames; i++)
+	VulkanRenderState baked = BakedRenderState(device, state);
+	configInfo.inputAssemblyInfo.topology = baked.topology;
+	configInfo.rasterizationInfo.cullMode = baked.cullMode;
+	configInfo.rasterizationInfo.frontFace = baked.frontFace;
+	configInfo.depthStencilInfo.depthTestEnable = baked.depthTest;
+	configInfo.depthStencilInfo.depthWriteEnable = baked.depthWrite;
+
+	VkColorBlendEquationEXT equation = BlendEquation(baked.blend);
+	configInfo.colorBlendAttachment.blendEnable = baked.blend != BlendMode::SOLID;
+	configInfo.colorBlendAttachment.srcColorBlendFactor = equation.srcColorBlendFactor;
+	configInfo.colorBlendAttachment.dstColorBlendFactor = equation.dstColorBlendFactor;
+	configInfo.colorBlendAttachment.colorBlendOp = equation.colorBlendOp;
+	configInfo.colorBlendAttachment.srcAlphaBlendFactor = equation.srcAlphaBlendFactor;
+	configInfo.colorBlendAttachment.dstAlphaBlendFactor = equation.dstAlphaBlendFactor;
+	configInfo.colorBlendAttachment.alphaBlendOp = equation.alphaBlendOp;
+
+	std::vector<VkDynamicState> &dynamicStates = configInfo.dynamicStateEnables;
+	if(device.DynamicState().HasRasterState())
+		dynamicStates.insert(dynamicStates.end(), {VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT, VK_DYNAMIC_STATE_CULL_MODE_EXT,
+			VK_DYNAMIC_STATE_FRONT_FACE_EXT, VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT, VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT});
+	if(device.DynamicState().HasBlendState())
+		dynamicStates.insert(dynamicStates.end(), {VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT, VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT});
+	configInfo.dynamicStateInfo.pDynamicStates = dynamicStates.data();
+	configInfo.dynamicStateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+}
+
+
+
+VulkanRenderState VulkanPipeline::BakedRenderState(const VulkanDevice &device, const VulkanRenderState &state)
+{
+	const ExtendedDynamicState &dynamicState = device.DynamicState();
+	VulkanRenderState baked = state;
+	if(dynamicState.HasRasterState())
 	{
-		for(int j = 0; j < shaderInfo.bufferCount; j++)
-		{
-			shaderInfo.descriptorSets.emplace_back();
-			auto bufferInfo = shaderInfo.uniformBuffer->DescriptorInfoForIndex(i * shaderInfo.bufferCount + j);
-			VulkanDescriptorWriter(*shaderInfo.desriptorSetLayout, *shaderInfo.desriptorPool)
-				.WriteBuffer(0, &bufferInfo)
-				.Build(shaderInfo.descriptorSets.back());
-		}
+		VulkanRenderState defaults;
+		baked.topology = dynamicState.unrestrictedTopology ? defaults.topology : TopologyClass(state.topology);
+		baked.cullMode = defaults.cullMode;
+		baked.frontFace = defaults.frontFace;
+		baked.depthTest = defaults.depthTest;
+		baked.depthWrite = defaults.depthWrite;
 	}
-
-	return shaderInfo;
+	if(dynamicState.HasBlendState())
+		baked.blend = BlendMode::SOLID;
+	return baked;
 }
 
 
 
-std::vector<char> VulkanPipeline::ReadFile(const std::string &filepath)
+VulkanShaderInfo VulkanPipeline::PrepareShaderInfo(VulkanDevice &device, ShaderInfo &inputInfo, const int maxFrames,
+	const std::map<uint32_t, VulkanDescriptorSetLayout *> &externalSets)
 {
-	std::ifstream file(filepath, std::ios::ate | std::ios::binary);
-
-	if(!file.is_open())
+	VulkanShaderLibrary &shaders = device.ShaderLibrary();
+	SpirvReflection reflection = shaders.Load(inputInfo.vertexShaderFilename)->reflection;
+	reflection.Merge(shaders.Load(inputInfo.fragmentShaderFilename)->reflection);
+	ResolveVertexInputs(reflection, inputInfo);
+	CheckSpecialization(reflection, inputInfo.specialization);
+
+	VulkanShaderInfo shaderInfo{};
+	CheckBlock(reflection.GetPushConstants(), inputInfo.pushConstantLayout, BlockLayout::STD430, "push constant");
+	shaderInfo.pushConstantSize = reflection.GetPushConstants().size;
+	shaderInfo.pushConstantStages = reflection.GetPushConstantStages();
+	if(shaderInfo.pushConstantSize > device.properties.limits.maxPushConstantsSize)
+		throw std::runtime_error("push constant block exceeds maxPushConstantsSize!");
+
+	// Every set below the highest one needs a layout, unused ones get the shared empty layout.
+	VulkanLayoutCache &layoutCache = device.LayoutCache();
+	const SpirvReflection::Binding *uniformBlock = nullptr;
+	std::vector<VkDescriptorSetLayout> setLayouts;
+	for(uint32_t set = 0; set < reflection.GetSetCount(); set++)
 	{
-		Logger::Error("Failed to open file: " + filepath);
-		throw std::runtime_error("failed to open file: " + filepath);
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+		auto external = externalSets.find(set);
+		for(const SpirvReflection::Binding &binding : reflection.GetBindings())
+		{
+			if(binding.set != set)
+				continue;
+			if(external != externalSets.end())
+			{
+				CheckExternalSet(*external->second, binding);
+				continue;
+			}
+
+			if(binding.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+			{
+				if(uniformBlock)
+					throw std::runtime_error("only one uniform block per pipeline is supported!");
+				uniformBlock = &binding;
+			}
+			if(!binding.count)
+				throw std::runtime_error("runtime sized descriptor arrays need an external set layout!");
+			bindings.push_back({binding.binding, LayoutType(binding.type), binding.count, binding.stages, nullptr});
+		}
+
+		if(external != externalSets.end())
+			setLayouts.push_back(external->second->GetDescriptorSetLayout());
+		else
+			setLayouts.push_back(layoutCache.GetDescriptorSetLayout(bindings).GetDescriptorSetLayout());
 	}
 
-	size_t fileSize = static_cast<size_t>(file.tellg());
-	std::vector<char> buffer(fileSize);
+	std::vector<VkPushConstantRange> pushConstantRanges;
+	if(shaderInfo.pushConstantSize)
+		pushConstantRanges.push_back({shaderInfo.pushConstantStages, 0, shaderInfo.pushConstantSize});
+	shaderInfo.pipelineLayout = layoutCache.GetPipelineLayout(setLayouts, pushConstantRanges);
 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
+	if(!uniformBlock && !inputInfo.uniformLayout.empty())
+		throw std::runtime_error("uniform layout does not match the shader!");
+	if(uniformBlock)
+	{
+		// The ring writes binding 0 of its own descriptor sets, so the block has to be alone in its set.
+		for(const SpirvReflection::Binding &binding : reflection.GetBindings())
+			if(binding.set == uniformBlock->set && &binding != uniformBlock)
+				throw std::runtime_error("the uniform block needs a descriptor set of its own!");
+		if(uniformBlock->binding != 0 || uniformBlock->count != 1)
+			throw std::runtime_error("the uniform block has to be a single block at binding 0!");
+
+		CheckBlock(uniformBlock->block, inputInfo.uniformLayout, BlockLayout::STD140, "uniform");
+		shaderInfo.uniformSize = uniformBlock->block.size;
+		shaderInfo.uniformSet = uniformBlock->set;
+		VulkanDescriptorSetLayout &setLayout = layoutCache.GetDescriptorSetLayout(
+			{{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, uniformBlock->stages, nullptr}});
+		shaderInfo.uniformRing = std::make_unique<VulkanUniformRing>(device, setLayout, shaderInfo.uniformSize, maxFrames);
+	}
 
-	file.close();
-	return buffer;
+	shaderInfo.reflection = std::move(reflection);
+	return shaderInfo;
 }
 
 
 
-void VulkanPipeline::CreateGraphicsPipeline(const std::string &vertFilePath, const std::string &fragFilePath,
-	const VulkanPipelineConfigInfo &configInfo, const std::vector<AttributeSize> &attributeDescriptors)
+void VulkanPipeline::CreateGraphicsPipeline(const VulkanShaderLibrary::Shader &vertShader,
+	const VulkanShaderLibrary::Shader &fragShader, const VulkanPipelineConfigInfo &configInfo,
+	const std::vector<AttributeSize> &attributeDescriptors,
+	const std::vector<AttributeSize> &instanceDescriptors, const SpecializationConstants &specialization)
 {
 	assert(configInfo.pipelineLayout != VK_NULL_HANDLE && "Cannot create pipeline, no layout specified.");
 	assert(configInfo.renderPass != VK_NULL_HANDLE && "Cannot create pipeline, no renderpass specified.");
 
-	auto vertCode = ReadFile(vertFilePath);
-	auto fragCode = ReadFile(fragFilePath);
+	// The modules are only needed while the pipeline is compiled, pipelines compiled at the same time share them.
+	VulkanShaderLibrary &shaders = device.ShaderLibrary();
+	SpirvReflection reflection = vertShader.reflection;
+	reflection.Merge(fragShader.reflection);
+	CheckSpecialization(reflection, specialization);
+	VkShaderModule vertShaderModule = shaders.AcquireModule(vertShader);
+	VkShaderModule fragShaderModule;
+	try
+	{
+		fragShaderModule = shaders.AcquireModule(fragShader);
+	}
+	catch(...)
+	{
+		shaders.ReleaseModule(vertShader);
+		throw;
+	}
 
-	CreateShaderModule(vertCode, &vertShaderModule);
-	CreateShaderModule(fragCode, &fragShaderModule);
+	// Both stages get the same constants, the ones a stage does not declare are ignored by it.
+	VkSpecializationInfo specializationInfo = specialization.GetInfo();
+	const VkSpecializationInfo *pSpecializationInfo = specialization.Empty() ? nullptr : &specializationInfo;
 
 	VkPipelineShaderStageCreateInfo shaderStages[2];
 	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -217,7 +451,7 @@ void VulkanPipeline::CreateGraphicsPipeline(const std::string &vertFilePath, con
 	shaderStages[0].pName = "main";
 	shaderStages[0].flags = 0;
 	shaderStages[0].pNext = nullptr;
-	shaderStages[0].pSpecializationInfo = nullptr;
+	shaderStages[0].pSpecializationInfo = pSpecializationInfo;
 
 	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -225,26 +459,35 @@ void VulkanPipeline::CreateGraphicsPipeline(const std::string &vertFilePath, con
 	shaderStages[1].pName = "main";
 	shaderStages[1].flags = 0;
 	shaderStages[1].pNext = nullptr;
-	shaderStages[1].pSpecializationInfo = nullptr;
+	shaderStages[1].pSpecializationInfo = pSpecializationInfo;
 
-	uint32_t sizePerVertex = 0;
-	for(const auto &attributeDescriptor : attributeDescriptors)
-		sizePerVertex += EsToVulkan::FORMAT_MAP_SIZE.at(attributeDescriptor);
+	std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+	// Binding 0 advances per vertex, binding 1 per instance. Locations are numbered across both bindings.
+	const std::vector<AttributeSize> *bindingLayouts[] = {&attributeDescriptors, &instanceDescriptors};
+	for(uint32_t binding = 0; binding < 2; binding++)
+	{
+		const std::vector<AttributeSize> &layout = *bindingLayouts[binding];
+		if(layout.empty())
+			continue;
 
-	std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
-	bindingDescriptions[0].binding = 0;
-	bindingDescriptions[0].stride = sizeof(float) * sizePerVertex;
-	bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		uint32_t offset = 0;
+		for(const auto &attributeDescriptor : layout)
+		{
+			VkVertexInputAttributeDescription attributeDescription{};
+			attributeDescription.binding = binding;
+			attributeDescription.location = static_cast<uint32_t>(attributeDescriptions.size());
+			attributeDescription.format = EsToVulkan::Format(attributeDescriptor);
+			attributeDescription.offset = offset;
+			attributeDescriptions.push_back(attributeDescription);
+			offset += EsToVulkan::ByteSize(attributeDescriptor);
+		}
 
-	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(attributeDescriptors.size());
-	uint32_t offset = 0;
-	for(int i = 0; i < attributeDescriptors.size(); i++)
-	{
-		attributeDescriptions[i].binding = 0;
-		attributeDescriptions[i].location = i;
-		attributeDescriptions[i].format = EsToVulkan::FORMAT_MAP_VULKAN.at(attributeDescriptors[i]);
-		attributeDescriptions[i].offset = offset;
-		offset += EsToVulkan::FORMAT_MAP_SIZE.at(attributeDescriptors[i]) * sizeof(float);
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = binding;
+		bindingDescription.stride = offset;
+		bindingDescription.inputRate = binding ? VK_VERTEX_INPUT_RATE_INSTANCE : VK_VERTEX_INPUT_RATE_VERTEX;
+		bindingDescriptions.push_back(bindingDescription);
 	}
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
@@ -274,19 +517,9 @@ void VulkanPipeline::CreateGraphicsPipeline(const std::string &vertFilePath, con
 	pipelineInfo.basePipelineIndex = -1;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-	if(vkCreateGraphicsPipelines(device.Device(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
+	VkResult result = device.PipelineCache().CreateGraphicsPipeline(pipelineInfo, &graphicsPipeline);
+	shaders.ReleaseModule(vertShader);
+	shaders.ReleaseModule(fragShader);
+	if(result != VK_SUCCESS)
 		throw std::runtime_error("failed to create graphics pipeline");
 }
-
-
-
-void VulkanPipeline::CreateShaderModule(const std::vector<char> &code, VkShaderModule *shaderModule)
-{
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-
-	if(vkCreateShaderModule(device.Device(), &createInfo, nullptr, shaderModule) != VK_SUCCESS)
-		throw std::runtime_error("failed to create shader module");
-}
@@ -1,15 +1,47 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
 #include <string>
+#include <tuple>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
+#include "spirv_reflection.h"
+#include "vulkan_descriptors.h"
 #include "vulkan_device.h"
+#include "vulkan_shader_library.h"
+#include "vulkan_uniform_ring.h"
 #include "es_vulkan.h"
+#include "specialization_constants.h"
 
 
 
+enum class BlendMode : uint32_t {
+	SOLID,
+	ALPHA,
+	ADDITIVE,
+};
+
+// Fixed function state that differs between draws of the same shaders. The parts the device can set dynamically
+// are set per draw batch, the rest is baked into the pipeline.
+struct VulkanRenderState {
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkCullModeFlags cullMode = VK_CULL_MODE_NONE;
+	VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+	bool depthTest = false;
+	bool depthWrite = true;
+	BlendMode blend = BlendMode::SOLID;
+
+	bool operator<(const VulkanRenderState &other) const
+	{
+		return std::tie(topology, cullMode, frontFace, depthTest, depthWrite, blend)
+			< std::tie(other.topology, other.cullMode, other.frontFace, other.depthTest, other.depthWrite, other.blend);
+	}
+	bool operator==(const VulkanRenderState &other) const { return !(*this < other) && !(other < *this); }
+	bool operator!=(const VulkanRenderState &other) const { return !(*this == other); }
+};
+
 struct VulkanPipelineConfigInfo {
 	VulkanPipelineConfigInfo() = default;
 	VulkanPipelineConfigInfo(const VulkanPipelineConfigInfo&) = delete;
@@ -29,21 +61,28 @@ struct VulkanPipelineConfigInfo {
 	uint32_t subpass = 0;
 };
 
+// Everything below is derived from the shaders' SPIR-V.
 struct VulkanShaderInfo {
-	std::unique_ptr<VulkanBuffer> uniformBuffer;
-	uint32_t bufferCount;
-
-	std::unique_ptr<VulkanDescriptorPool> desriptorPool;
-	std::unique_ptr<VulkanDescriptorSetLayout> desriptorSetLayout;
-	std::vector<VkDescriptorSet> descriptorSets;
-
-	std::vector<uint32_t> GetDynamicOffsets(uint imageIndex, uint numElements);
+	uint32_t uniformSize;
+	// The set the uniform ring's descriptor sets are bound to.
+	uint32_t uniformSet;
+	uint32_t pushConstantSize;
+	VkShaderStageFlags pushConstantStages;
+
+	// Owned by the device's layout cache, pipelines with equal layouts share it.
+	VkPipelineLayout pipelineLayout;
+	// The uniform ring is only created if the shaders declare a uniform block.
+	std::unique_ptr<VulkanUniformRing> uniformRing;
+	// The merged interface of both stages. A reloaded shader has to match it to reuse everything above.
+	SpirvReflection reflection;
 };
 
 class VulkanPipeline {
 public:
-	VulkanPipeline(VulkanDevice &device, const std::string &vertFilePath, const std::string &fragFilePath,
-		const VulkanPipelineConfigInfo &configInfo, const std::vector<AttributeSize> &attributeDescriptors);
+	// Built from the given shader code, a reload of their files in the meantime does not affect the pipeline.
+	VulkanPipeline(VulkanDevice &device, const VulkanShaderLibrary::Shader &vertShader, const VulkanShaderLibrary::Shader &fragShader,
+		const VulkanPipelineConfigInfo &configInfo, const std::vector<AttributeSize> &attributeDescriptors,
+		const std::vector<AttributeSize> &instanceDescriptors = {}, const SpecializationConstants &specialization = {});
 	~VulkanPipeline();
 
 	VulkanPipeline(const VulkanPipeline &) = delete;
@@ -52,22 +91,34 @@ public:
 	VulkanPipeline &operator=(VulkanPipeline &&) = delete;
 
 	void Bind(VkCommandBuffer commandBuffer);
+	// Records the parts of the render state this pipeline left dynamic.
+	void SetDynamicState(VkCommandBuffer commandBuffer, const VulkanRenderState &state) const;
+	bool HasDynamicRasterState() const { return dynamicRasterState; }
+	bool HasDynamicBlendState() const { return dynamicBlendState; }
+
+	static void PushConstants(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, const VulkanShaderInfo &shaderInfo,
+		const void *data, uint32_t size);
 	static void DefaultPipelineConfigInfo(VulkanPipelineConfigInfo &configInfo);
+	// Bakes the render state into the config, except for the parts the device supports as dynamic state.
+	static void SetRenderState(const VulkanDevice &device, VulkanPipelineConfigInfo &configInfo, const VulkanRenderState &state);
+	// The part of the state a pipeline is actually created for. States with equal baked parts can share a pipeline.
+	static VulkanRenderState BakedRenderState(const VulkanDevice &device, const VulkanRenderState &state);
 
-	static VulkanShaderInfo PrepareShaderInfo(VulkanDevice &device, ShaderInfo &inputInfo, const int maxFrames);
+	// Reflects both shaders to build the pipeline layout. Sets owned elsewhere, like the bindless texture table,
+	// are passed as externalSets and only checked against the shaders. An empty attribute and instance layout
+	// is filled in from the vertex inputs, declared layouts and blocks are checked against the shaders.
+	static VulkanShaderInfo PrepareShaderInfo(VulkanDevice &device, ShaderInfo &inputInfo, const int maxFrames,
+		const std::map<uint32_t, VulkanDescriptorSetLayout *> &externalSets = {});
 
 private:
-	static std::vector<char> ReadFile(const std::string &filepath);
-
-	void CreateGraphicsPipeline(const std::string &vertFilePath, const std::string &fragFilePath,
-		const VulkanPipelineConfigInfo &configInfo, const std::vector<AttributeSize> &attributeDescriptors);
-
-	void CreateShaderModule(const std::vector<char> &code, VkShaderModule *shaderModule);
+	void CreateGraphicsPipeline(const VulkanShaderLibrary::Shader &vertShader, const VulkanShaderLibrary::Shader &fragShader,
+		const VulkanPipelineConfigInfo &configInfo, const std::vector<AttributeSize> &attributeDescriptors,
+		const std::vector<AttributeSize> &instanceDescriptors, const SpecializationConstants &specialization);
 
 
 	VulkanDevice &device;
 
 	VkPipeline graphicsPipeline;
-	VkShaderModule vertShaderModule;
-	VkShaderModule fragShaderModule;
+	bool dynamicRasterState = false;
+	bool dynamicBlendState = false;
 };
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "vulkan_pipeline_cache.h"
+
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <stdexcept>
+#include <vector>
+
+#ifdef LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+
+namespace {
+	// Writes the file and waits until it is on disk.
+	bool WriteFile(const std::string &path, const char *data, size_t size)
+	{
+		FILE *file = fopen(path.c_str(), "wb");
+		if(!file)
+			return false;
+		bool written = fwrite(data, 1, size, file) == size && !fflush(file);
+#ifdef LINUX
+		written = written && !fsync(fileno(file));
+#endif
+		return !fclose(file) && written;
+	}
+
+
+
+	// A rename is only durable once the directory holding the file is synced.
+	void SyncDirectory(const std::string &path)
+	{
+#ifdef LINUX
+		size_t slash = path.rfind('/');
+		std::string directory = slash == std::string::npos ? "." : slash ? path.substr(0, slash) : "/";
+		int descriptor = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+		if(descriptor < 0)
+			return;
+		fsync(descriptor);
+		close(descriptor);
+#endif
+	}
+}
+
+
+VulkanPipelineCache::VulkanPipelineCache(VulkanDevice &device, const std::string &filepath, bool creationFeedback)
+: device{device}, filepath{filepath}, creationFeedback{creationFeedback}
+{
+	std::vector<char> data;
+	std::ifstream file(filepath, std::ios::ate | std::ios::binary);
+	if(file.is_open())
+	{
+		// tellg() fails with -1.
+		std::streamoff size = file.tellg();
+		if(size > 0)
+		{
+			data.resize(static_cast<size_t>(size));
+			file.seekg(0);
+			file.read(data.data(), data.size());
+		}
+		if(!file || size <= 0 || !IsCompatible(data))
+		{
+			Logger::Status("Pipeline cache " + filepath + " is stale or broken, starting with an empty cache");
+			data.clear();
+		}
+		else
+			Logger::Status("Pipeline cache: loaded " + std::to_string(data.size() / 1024) + " KiB from " + filepath);
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+	if(vkCreatePipelineCache(device.Device(), &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+		throw std::runtime_error("failed to create pipeline cache!");
+}
+
+
+
+VulkanPipelineCache::~VulkanPipelineCache()
+{
+	Save();
+	vkDestroyPipelineCache(device.Device(), pipelineCache, nullptr);
+}
+
+
+
+VkResult VulkanPipelineCache::CreateGraphicsPipeline(const VkGraphicsPipelineCreateInfo &pipelineInfo, VkPipeline *pipeline)
+{
+	VkGraphicsPipelineCreateInfo info = pipelineInfo;
+	VkPipelineCreationFeedbackEXT feedback{};
+	std::vector<VkPipelineCreationFeedbackEXT> stageFeedback(info.stageCount);
+	VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo{};
+	if(creationFeedback)
+	{
+		feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+		feedbackInfo.pNext = info.pNext;
+		feedbackInfo.pPipelineCreationFeedback = &feedback;
+		feedbackInfo.pipelineStageCreationFeedbackCount = info.stageCount;
+		feedbackInfo.pPipelineStageCreationFeedbacks = stageFeedback.data();
+		info.pNext = &feedbackInfo;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	VkResult result = vkCreateGraphicsPipelines(device.Device(), pipelineCache, 1, &info, nullptr, pipeline);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	pipelineCount++;
+	compileTime += elapsed;
+	if((feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)
+			&& (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT))
+		cacheHits++;
+	return result;
+}
+
+
+
+void VulkanPipelineCache::Save() const
+{
+	size_t size = 0;
+	std::vector<char> data;
+	if(vkGetPipelineCacheData(device.Device(), pipelineCache, &size, nullptr) == VK_SUCCESS)
+	{
+		data.resize(size);
+		if(vkGetPipelineCacheData(device.Device(), pipelineCache, &size, data.data()) != VK_SUCCESS)
+			data.clear();
+	}
+	if(data.empty())
+	{
+		Logger::Error("Failed to read back the pipeline cache");
+		return;
+	}
+
+	// Losing the cache only costs startup time, so failures are logged rather than thrown.
+	std::string tempPath = filepath + ".tmp";
+	if(!WriteFile(tempPath, data.data(), size))
+	{
+		Logger::Error("Failed to write pipeline cache: " + tempPath);
+		std::remove(tempPath.c_str());
+		return;
+	}
+	if(std::rename(tempPath.c_str(), filepath.c_str()))
+	{
+		Logger::Error("Failed to replace pipeline cache: " + filepath);
+		std::remove(tempPath.c_str());
+		return;
+	}
+	SyncDirectory(filepath);
+}
+
+
+
+void VulkanPipelineCache::LogStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(compileTime).count();
+	std::string hits = creationFeedback
+		? std::to_string(cacheHits) + " / " + std::to_string(pipelineCount) + " cache hits"
+		: "hit rate unknown without creation feedback";
+	Logger::Status("Pipelines: " + std::to_string(pipelineCount) + " compiled in " + std::to_string(milliseconds) + " ms, "
+		+ hits);
+}
+
+
+
+bool VulkanPipelineCache::IsCompatible(const std::vector<char> &data) const
+{
+	VkPipelineCacheHeaderVersionOne header;
+	if(data.size() < sizeof(header))
+		return false;
+	memcpy(&header, data.data(), sizeof(header));
+
+	return header.headerSize >= sizeof(header) && header.headerSize <= data.size()
+		&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.vendorID == device.properties.vendorID
+		&& header.deviceID == device.properties.deviceID
+		&& !memcmp(header.pipelineCacheUUID, device.properties.pipelineCacheUUID, VK_UUID_SIZE);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "vulkan_device.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+
+
+// The driver's pipeline cache, kept on disk between runs. A file written by another device or driver version
+// is ignored, the driver would reject it anyway. The cache is saved again when it is destroyed.
+class VulkanPipelineCache {
+public:
+	static constexpr const char *DEFAULT_FILE = "pipeline_cache.bin";
+
+	// Creation feedback is only available with VK_EXT_pipeline_creation_feedback, without it hits are not counted.
+	VulkanPipelineCache(VulkanDevice &device, const std::string &filepath, bool creationFeedback);
+	~VulkanPipelineCache();
+
+	VulkanPipelineCache(const VulkanPipelineCache &) = delete;
+	VulkanPipelineCache &operator=(const VulkanPipelineCache &) = delete;
+
+	VkPipelineCache GetPipelineCache() const { return pipelineCache; }
+
+	// Creates the pipeline through the cache and records its compile time. May be called from several threads.
+	VkResult CreateGraphicsPipeline(const VkGraphicsPipelineCreateInfo &pipelineInfo, VkPipeline *pipeline);
+
+	// Writes a temporary file and renames it over the old one, so an interrupted save never leaves a broken cache.
+	// On Linux both the file and the rename are synced to disk, so a crash right after cannot either.
+	void Save() const;
+
+	void LogStats();
+
+private:
+	bool IsCompatible(const std::vector<char> &data) const;
+
+	VulkanDevice &device;
+	std::string filepath;
+	bool creationFeedback;
+	VkPipelineCache pipelineCache;
+
+	std::mutex mutex;
+	uint32_t pipelineCount = 0;
+	uint32_t cacheHits = 0;
+	std::chrono::steady_clock::duration compileTime{};
+};
@@ -0,0 +1,229 @@
+#include "vulkan_pipeline_registry.h"
+
+#include "logger.h"
+
+#include <stdexcept>
+
+
+
+namespace {
+	// FNV-1a over the bytes of a 64 bit word.
+	void HashWord(uint64_t &hash, uint64_t word)
+	{
+		for(int i = 0; i < 8; i++)
+			hash = (hash ^ ((word >> (8 * i)) & 0xFF)) * 1099511628211ull;
+	}
+}
+
+
+
+bool VulkanPipelineRegistry::Key::operator==(const Key &other) const
+{
+	return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader
+		&& attributeLayout == other.attributeLayout && instanceLayout == other.instanceLayout
+		&& pipelineLayout == other.pipelineLayout && renderState == other.renderState
+		&& renderPass == other.renderPass && specialization == other.specialization;
+}
+
+
+
+size_t VulkanPipelineRegistry::KeyHash::operator()(const Key &key) const
+{
+	uint64_t hash = 14695981039346656037ull;
+	HashWord(hash, key.vertexShader);
+	HashWord(hash, key.fragmentShader);
+	// The sizes keep attributes from moving between the two layouts unnoticed.
+	HashWord(hash, key.attributeLayout.size());
+	for(AttributeSize attribute : key.attributeLayout)
+		HashWord(hash, static_cast<uint64_t>(attribute));
+	HashWord(hash, key.instanceLayout.size());
+	for(AttributeSize attribute : key.instanceLayout)
+		HashWord(hash, static_cast<uint64_t>(attribute));
+	HashWord(hash, reinterpret_cast<uint64_t>(key.pipelineLayout));
+
+	const VulkanRenderState &state = key.renderState;
+	HashWord(hash, state.topology);
+	HashWord(hash, state.cullMode);
+	HashWord(hash, state.frontFace);
+	HashWord(hash, state.depthTest | state.depthWrite << 1);
+	HashWord(hash, static_cast<uint64_t>(state.blend));
+
+	HashWord(hash, key.renderPass.colorFormat);
+	HashWord(hash, key.renderPass.depthFormat);
+	HashWord(hash, key.renderPass.samples);
+	for(const SpecializationConstants::Constant &constant : key.specialization.GetConstants())
+		HashWord(hash, static_cast<uint64_t>(constant.id) << 32 | constant.bits);
+	return static_cast<size_t>(hash);
+}
+
+
+
+VulkanPipeline *VulkanPipelineRegistry::Handle::Get() const
+{
+	for(const Entry *it = entry.get(); it; it = it->fallback.get())
+		if(it->ready.load(std::memory_order_acquire) && it->pipeline)
+			return it->pipeline.get();
+	return nullptr;
+}
+
+
+
+bool VulkanPipelineRegistry::Handle::IsReady() const
+{
+	return entry && entry->ready.load(std::memory_order_acquire);
+}
+
+
+
+void VulkanPipelineRegistry::Handle::Wait() const
+{
+	if(entry)
+		entry->done.wait();
+}
+
+
+
+std::shared_future<void> VulkanPipelineRegistry::Handle::GetFuture() const
+{
+	return entry ? entry->done : std::shared_future<void>();
+}
+
+
+
+VulkanPipelineRegistry::VulkanPipelineRegistry(VulkanDevice &device, ThreadPool &threadPool)
+: device(device), threadPool(threadPool)
+{
+}
+
+
+
+VulkanPipelineRegistry::~VulkanPipelineRegistry()
+{
+	for(auto &it : entries)
+		it.second->done.wait();
+}
+
+
+
+VulkanPipelineRegistry::Handle VulkanPipelineRegistry::Acquire(const Request &request, const Handle &fallback)
+{
+	VulkanShaderLibrary &shaders = device.ShaderLibrary();
+	std::shared_ptr<const VulkanShaderLibrary::Shader> vertexShader = shaders.Load(request.vertexShaderFilename);
+	std::shared_ptr<const VulkanShaderLibrary::Shader> fragmentShader = shaders.Load(request.fragmentShaderFilename);
+	Key key{vertexShader->hash, fragmentShader->hash,
+		request.attributeLayout, request.instanceLayout, request.pipelineLayout,
+		VulkanPipeline::BakedRenderState(device, request.renderState), request.renderPassKey, request.specialization};
+
+	std::lock_guard<std::mutex> lock(mutex);
+	requests++;
+	auto it = entries.find(key);
+	if(it != entries.end())
+	{
+		shared++;
+		return Handle(it->second);
+	}
+
+	auto entry = std::make_shared<Entry>();
+	entry->fallback = fallback.entry;
+	entry->renderPass = request.renderPass;
+	Request compileRequest = request;
+	compileRequest.renderState = key.renderState;
+	// The job's future is stored in the entry, so the job holds a plain pointer, a shared one would keep the entry
+	// alive for good. Collect() only erases entries once compiled, and the destructor waits for the rest.
+	Entry *target = entry.get();
+	entry->done = threadPool.Run([this, target, compileRequest, vertexShader, fragmentShader]()
+		{ Compile(*target, compileRequest, vertexShader, fragmentShader); }).share();
+	entries.emplace(std::move(key), entry);
+	return Handle(entry);
+}
+
+
+
+void VulkanPipelineRegistry::Collect()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for(auto it = retired.begin(); it != retired.end(); )
+		it = device.IsFrameComplete(it->first) ? retired.erase(it) : it + 1;
+
+	// Fallbacks go first, they may be the last reference to another entry.
+	for(auto &it : entries)
+		if(it.second->ready.load(std::memory_order_acquire) && it.second->pipeline)
+			it.second->fallback.reset();
+
+	// Frames up to the last submitted one may still draw with a pipeline whose last handle was just dropped.
+	for(auto it = entries.begin(); it != entries.end(); )
+	{
+		Entry &entry = *it->second;
+		if(it->second.use_count() > 1 || !entry.ready.load(std::memory_order_acquire))
+		{
+			++it;
+			continue;
+		}
+		if(entry.pipeline)
+			retired.emplace_back(device.SubmittedFrame(), std::move(entry.pipeline));
+		retiredCount++;
+		it = entries.erase(it);
+	}
+}
+
+
+
+void VulkanPipelineRegistry::WaitForCompiles(VkRenderPass renderPass)
+{
+	// Waits outside of the lock, so other threads can still acquire pipelines meanwhile.
+	std::vector<std::shared_future<void>> compiles;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(auto &it : entries)
+			if(it.second->renderPass == renderPass && !it.second->ready.load(std::memory_order_acquire))
+				compiles.push_back(it.second->done);
+	}
+	for(auto &compile : compiles)
+		compile.wait();
+}
+
+
+
+size_t VulkanPipelineRegistry::GetCompilingCount()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t count = 0;
+	for(auto &it : entries)
+		if(!it.second->ready.load(std::memory_order_acquire))
+			count++;
+	return count;
+}
+
+
+
+void VulkanPipelineRegistry::LogStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Logger::Status("Pipeline registry: " + std::to_string(entries.size()) + " pipelines, " + std::to_string(shared)
+		+ " / " + std::to_string(requests) + " requests shared, " + std::to_string(failures.load()) + " failed, "
+		+ std::to_string(retiredCount) + " retired");
+}
+
+
+
+void VulkanPipelineRegistry::Compile(Entry &entry, const Request &request,
+	const std::shared_ptr<const VulkanShaderLibrary::Shader> &vertexShader,
+	const std::shared_ptr<const VulkanShaderLibrary::Shader> &fragmentShader)
+{
+	try
+	{
+		VulkanPipelineConfigInfo pipelineConfig{};
+		VulkanPipeline::DefaultPipelineConfigInfo(pipelineConfig);
+		VulkanPipeline::SetRenderState(device, pipelineConfig, request.renderState);
+		pipelineConfig.renderPass = request.renderPass;
+		pipelineConfig.pipelineLayout = request.pipelineLayout;
+		entry.pipeline = std::make_unique<VulkanPipeline>(device, *vertexShader, *fragmentShader,
+			pipelineConfig, request.attributeLayout, request.instanceLayout, request.specialization);
+	}
+	catch(const std::exception &error)
+	{
+		failures++;
+		Logger::Error("Failed to compile pipeline for " + request.vertexShaderFilename + ": " + error.what());
+	}
+	entry.ready.store(true, std::memory_order_release);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "es_vulkan.h"
+#include "specialization_constants.h"
+#include "thread_pool.h"
+#include "vulkan_device.h"
+#include "vulkan_pipeline.h"
+#include "vulkan_shader_library.h"
+#include "vulkan_swapchain.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Every pipeline in use, keyed by the full state it is compiled from, so equal requests share one VkPipeline.
+// Unseen requests compile on the thread pool while the fallback they were acquired with is drawn instead.
+// Handles are acquired and dropped on the main thread, pipelines nobody holds are destroyed once the GPU is done.
+class VulkanPipelineRegistry {
+public:
+	struct Request {
+		std::string vertexShaderFilename;
+		std::string fragmentShaderFilename;
+		std::vector<AttributeSize> attributeLayout;
+		std::vector<AttributeSize> instanceLayout;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VulkanRenderState renderState;
+		SpecializationConstants specialization;
+		// Any render pass of the compatibility class will do, the pipeline is shared with all of them.
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		VulkanSwapChain::RenderPassKey renderPassKey{};
+	};
+
+private:
+	struct Key {
+		uint64_t vertexShader;
+		uint64_t fragmentShader;
+		std::vector<AttributeSize> attributeLayout;
+		std::vector<AttributeSize> instanceLayout;
+		// Layouts come from the layout cache, equal layouts have equal handles.
+		VkPipelineLayout pipelineLayout;
+		// Only the baked part, states that differ in dynamic state share a pipeline.
+		VulkanRenderState renderState;
+		VulkanSwapChain::RenderPassKey renderPass;
+		SpecializationConstants specialization;
+
+		bool operator==(const Key &other) const;
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key &key) const;
+	};
+
+	struct Entry {
+		std::unique_ptr<VulkanPipeline> pipeline;
+		// Set once the compile finished, the pipeline is null if it failed.
+		std::atomic<bool> ready{false};
+		std::shared_future<void> done;
+		// Drawn until the pipeline is ready, released by Collect() afterwards.
+		std::shared_ptr<Entry> fallback;
+		// The render pass the compile borrows, it has to outlive the compile.
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+	};
+
+public:
+	class Handle {
+	public:
+		Handle() = default;
+
+		// The compiled pipeline, or the closest ready fallback while it compiles. Null if there is none.
+		VulkanPipeline *Get() const;
+		bool IsReady() const;
+		// Blocks until the pipeline compiled or failed to.
+		void Wait() const;
+		// Becomes ready when Wait() would return. Invalid for an empty handle.
+		std::shared_future<void> GetFuture() const;
+
+		explicit operator bool() const { return entry != nullptr; }
+
+	private:
+		friend class VulkanPipelineRegistry;
+		explicit Handle(std::shared_ptr<Entry> entry) : entry(std::move(entry)) {}
+
+		std::shared_ptr<Entry> entry;
+	};
+
+	VulkanPipelineRegistry(VulkanDevice &device, ThreadPool &threadPool);
+	~VulkanPipelineRegistry();
+
+	VulkanPipelineRegistry(const VulkanPipelineRegistry &) = delete;
+	VulkanPipelineRegistry &operator=(const VulkanPipelineRegistry &) = delete;
+
+	// Returns the registered pipeline for an equal request, or starts compiling a new one.
+	Handle Acquire(const Request &request, const Handle &fallback = Handle());
+	// Call once per frame. Releases the fallbacks of compiled pipelines and retires pipelines without handles,
+	// they are destroyed after the GPU finished the last submitted frame.
+	void Collect();
+
+	// Blocks until every pipeline compiling with the given render pass has compiled or failed to.
+	void WaitForCompiles(VkRenderPass renderPass);
+	// Pipelines acquired but not compiled yet.
+	size_t GetCompilingCount();
+	void LogStats();
+
+private:
+	// The shaders are the ones the entry's key was made from, not whatever their files hold by now.
+	void Compile(Entry &entry, const Request &request,
+		const std::shared_ptr<const VulkanShaderLibrary::Shader> &vertexShader,
+		const std::shared_ptr<const VulkanShaderLibrary::Shader> &fragmentShader);
+
+
+	VulkanDevice &device;
+	ThreadPool &threadPool;
+
+	std::mutex mutex;
+	std::unordered_map<Key, std::shared_ptr<Entry>, KeyHash> entries;
+	std::vector<std::pair<uint64_t, std::unique_ptr<VulkanPipeline>>> retired;
+
+	uint64_t requests = 0;
+	uint64_t shared = 0;
+	// Entries dropped by Collect(). If this stays at zero while handles come and go, something else holds on to entries.
+	uint64_t retiredCount = 0;
+	std::atomic<uint64_t> failures{0};
+};
@@ -0,0 +1,207 @@
+#include "vulkan_shader_library.h"
+
+#include "logger.h"
+
+#include <fstream>
+#include <ios>
+#include <stdexcept>
+
+#ifdef ES_SHADER_HOT_RELOAD
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+
+VulkanShaderLibrary::VulkanShaderLibrary(VulkanDevice &device)
+: device{device}
+{
+#ifdef ES_SHADER_HOT_RELOAD
+	inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(inotify < 0)
+		Logger::Error("Failed to start inotify, shader hot reload is disabled");
+#endif
+}
+
+
+
+VulkanShaderLibrary::~VulkanShaderLibrary()
+{
+	for(auto &it : modules)
+		vkDestroyShaderModule(device.Device(), it.second.module, nullptr);
+#ifdef ES_SHADER_HOT_RELOAD
+	if(inotify >= 0)
+		close(inotify);
+#endif
+}
+
+
+
+std::shared_ptr<const VulkanShaderLibrary::Shader> VulkanShaderLibrary::Load(const std::string &filepath)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = shaders.find(filepath);
+		if(it != shaders.end())
+			return it->second;
+	}
+
+	// Read and reflect outside the lock. If two threads race for the same file, the first one to finish wins.
+	std::shared_ptr<const Shader> shader = CreateShader(filepath);
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = shaders.emplace(filepath, shader);
+	if(it.second)
+		Watch(filepath);
+	return it.first->second;
+}
+
+
+
+VkShaderModule VulkanShaderLibrary::AcquireModule(const Shader &shader)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = modules.find(shader.hash);
+	if(it == modules.end())
+	{
+		VkShaderModuleCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = shader.code.size();
+		createInfo.pCode = reinterpret_cast<const uint32_t *>(shader.code.data());
+
+		Module module{VK_NULL_HANDLE, 0};
+		if(vkCreateShaderModule(device.Device(), &createInfo, nullptr, &module.module) != VK_SUCCESS)
+			throw std::runtime_error("failed to create shader module");
+		it = modules.emplace(shader.hash, module).first;
+	}
+	it->second.users++;
+	return it->second.module;
+}
+
+
+
+void VulkanShaderLibrary::ReleaseModule(const Shader &shader)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = modules.find(shader.hash);
+	if(it == modules.end())
+		return;
+	if(!--it->second.users)
+	{
+		vkDestroyShaderModule(device.Device(), it->second.module, nullptr);
+		modules.erase(it);
+	}
+}
+
+
+
+std::vector<std::string> VulkanShaderLibrary::PollChanges()
+{
+	std::vector<std::string> changed;
+#ifdef ES_SHADER_HOT_RELOAD
+	if(inotify < 0)
+		return changed;
+
+	std::vector<std::string> written;
+	alignas(inotify_event) char buffer[4096];
+	ssize_t length;
+	while((length = read(inotify, buffer, sizeof(buffer))) > 0)
+		for(char *event = buffer; event < buffer + length; )
+		{
+			const inotify_event *info = reinterpret_cast<const inotify_event *>(event);
+			std::lock_guard<std::mutex> lock(mutex);
+			auto directory = watchedDirectories.find(info->wd);
+			if(info->len && directory != watchedDirectories.end())
+				written.push_back(directory->second + info->name);
+			event += sizeof(inotify_event) + info->len;
+		}
+
+	for(const std::string &filepath : written)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = shaders.find(filepath);
+			if(it == shaders.end())
+				continue;
+		}
+
+		std::shared_ptr<const Shader> shader;
+		try
+		{
+			shader = CreateShader(filepath);
+		}
+		catch(const std::exception &error)
+		{
+			Logger::Error("Failed to reload " + filepath + ": " + error.what());
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		std::shared_ptr<const Shader> &current = shaders[filepath];
+		// Compilers often write a file more than once, only real changes count.
+		if(current->hash == shader->hash)
+			continue;
+		current = shader;
+		changed.push_back(filepath);
+		Logger::Status("Reloaded shader " + filepath);
+	}
+#endif
+	return changed;
+}
+
+
+
+std::vector<char> VulkanShaderLibrary::ReadFile(const std::string &filepath)
+{
+	std::ifstream file(filepath, std::ios::ate | std::ios::binary);
+
+	if(!file.is_open())
+	{
+		Logger::Error("Failed to open file: " + filepath);
+		throw std::runtime_error("failed to open file: " + filepath);
+	}
+
+	size_t fileSize = static_cast<size_t>(file.tellg());
+	std::vector<char> buffer(fileSize);
+
+	file.seekg(0);
+	file.read(buffer.data(), fileSize);
+
+	file.close();
+	return buffer;
+}
+
+
+
+std::shared_ptr<const VulkanShaderLibrary::Shader> VulkanShaderLibrary::CreateShader(const std::string &filepath)
+{
+	auto shader = std::make_shared<Shader>();
+	shader->filepath = filepath;
+	shader->code = ReadFile(filepath);
+	shader->reflection = SpirvReflection(shader->code);
+
+	shader->hash = 14695981039346656037ull;
+	for(char byte : shader->code)
+		shader->hash = (shader->hash ^ static_cast<unsigned char>(byte)) * 1099511628211ull;
+	return shader;
+}
+
+
+
+void VulkanShaderLibrary::Watch(const std::string &filepath)
+{
+#ifdef ES_SHADER_HOT_RELOAD
+	if(inotify < 0)
+		return;
+
+	// Directories are watched rather than files, because compilers may replace a file instead of rewriting it.
+	size_t slash = filepath.find_last_of('/');
+	std::string directory = slash == std::string::npos ? "./" : filepath.substr(0, slash + 1);
+	int watch = inotify_add_watch(inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if(watch < 0)
+		Logger::Error("Failed to watch shader directory " + directory);
+	else
+		watchedDirectories[watch] = directory;
+#else
+	(void)filepath;
+#endif
+}
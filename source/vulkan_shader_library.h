@@ -0,0 +1,71 @@
+#pragma once
+
+#include "spirv_reflection.h"
+#include "vulkan_device.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+// Hot reload is a development aid, it needs inotify and is left out of release builds.
+#if defined(LINUX) && !defined(NDEBUG)
+#define ES_SHADER_HOT_RELOAD
+#endif
+
+
+
+// SPIR-V of every shader in use, read from disk and reflected once and shared by all pipelines.
+// Shader modules only exist while pipelines are being created from them.
+class VulkanShaderLibrary {
+public:
+	struct Shader {
+		std::string filepath;
+		std::vector<char> code;
+		// FNV-1a of the code, identical code in different files shares a shader module.
+		uint64_t hash;
+		SpirvReflection reflection;
+	};
+
+	explicit VulkanShaderLibrary(VulkanDevice &device);
+	~VulkanShaderLibrary();
+
+	VulkanShaderLibrary(const VulkanShaderLibrary &) = delete;
+	VulkanShaderLibrary &operator=(const VulkanShaderLibrary &) = delete;
+
+	// Reads the file on first use. A reload replaces the shader, earlier results keep the old code alive.
+	std::shared_ptr<const Shader> Load(const std::string &filepath);
+
+	// The module is created by the first acquire and destroyed by the last release. Thread safe.
+	VkShaderModule AcquireModule(const Shader &shader);
+	void ReleaseModule(const Shader &shader);
+
+	// Reloads every shader whose file was rewritten since the last call and returns their paths.
+	// Files that fail to load or reflect keep their previous code. Always empty without hot reload.
+	std::vector<std::string> PollChanges();
+
+private:
+	static std::vector<char> ReadFile(const std::string &filepath);
+	static std::shared_ptr<const Shader> CreateShader(const std::string &filepath);
+	void Watch(const std::string &filepath);
+
+	struct Module {
+		VkShaderModule module;
+		uint32_t users;
+	};
+
+	VulkanDevice &device;
+
+	std::mutex mutex;
+	std::map<std::string, std::shared_ptr<const Shader>> shaders;
+	std::map<uint64_t, Module> modules;
+
+#ifdef ES_SHADER_HOT_RELOAD
+	int inotify = -1;
+	// Watch descriptors of the directories holding loaded shaders.
+	std::map<int, std::string> watchedDirectories;
+#endif
+};
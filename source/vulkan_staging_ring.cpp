@@ -0,0 +1,114 @@
+#include "vulkan_staging_ring.h"
+
+#include <stdexcept>
+
+
+
+namespace {
+	VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+
+
+VulkanStagingRing::VulkanStagingRing(VulkanDevice &device, VkDeviceSize capacity)
+: device{device}, capacity{capacity}
+{
+	buffer = std::make_unique<VulkanBuffer>(device, capacity, 1,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	buffer->Map();
+}
+
+
+
+VulkanStagingRing::~VulkanStagingRing() { }
+
+
+
+VulkanStagingRegion VulkanStagingRing::Reserve(VkDeviceSize size, VkDeviceSize alignment)
+{
+	VulkanStagingRegion region;
+	if(!TryReserve(size, alignment, region))
+		throw std::runtime_error("upload does not fit into the staging ring!");
+	return region;
+}
+
+
+
+bool VulkanStagingRing::TryReserve(VkDeviceSize size, VkDeviceSize alignment, VulkanStagingRegion &region)
+{
+	if(size > capacity)
+		return false;
+
+	Reclaim();
+
+	VkDeviceSize offset;
+	while(!Fit(size, alignment, offset))
+	{
+		if(spans.empty())
+			return false;
+
+		// Block on the oldest submission, it is the one standing in front of the free space.
+		device.WaitForUpload(spans.front().submission);
+		Reclaim();
+	}
+
+	head = offset + size;
+	hasPending = true;
+
+	region.buffer = buffer->GetBuffer();
+	region.offset = offset;
+	region.size = size;
+	region.data = static_cast<char *>(buffer->GetMappedMemory()) + offset;
+	return true;
+}
+
+
+
+void VulkanStagingRing::Retire(uint64_t submission)
+{
+	if(!hasPending)
+		return;
+
+	spans.push_back({submission, head});
+	hasPending = false;
+}
+
+
+
+bool VulkanStagingRing::Fit(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset) const
+{
+	if(!hasPending && spans.empty())
+	{
+		offset = 0;
+		return size <= capacity;
+	}
+
+	offset = AlignUp(head, alignment);
+	if(tail < head)
+	{
+		if(offset + size <= capacity)
+			return true;
+		// Wrap around, the bytes left at the end stay unused until the tail passes them.
+		offset = 0;
+		return size <= tail;
+	}
+	// The used range wrapped (or the ring is exactly full), free space is only between head and tail.
+	return offset + size <= tail;
+}
+
+
+
+void VulkanStagingRing::Reclaim()
+{
+	while(!spans.empty() && device.IsUploadComplete(spans.front().submission))
+	{
+		tail = spans.front().end;
+		spans.pop_front();
+	}
+	if(!hasPending && spans.empty())
+		head = tail = 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "vulkan_buffer.h"
+#include "vulkan_device.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vulkan/vulkan_core.h>
+
+
+
+struct VulkanStagingRegion {
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	void *data;
+};
+
+// Long lived, persistently mapped ring of host visible memory that all uploads copy their source data from.
+// Reservations made since the last Retire() belong to that submission and are reclaimed once it completes.
+class VulkanStagingRing {
+public:
+	static constexpr VkDeviceSize DEFAULT_CAPACITY = 64 * 1024 * 1024;
+
+	VulkanStagingRing(VulkanDevice &device, VkDeviceSize capacity = DEFAULT_CAPACITY);
+	~VulkanStagingRing();
+
+	VulkanStagingRing(const VulkanStagingRing &) = delete;
+	VulkanStagingRing &operator=(const VulkanStagingRing &) = delete;
+
+	// Waits for older submissions if necessary, throws if the region can never fit.
+	VulkanStagingRegion Reserve(VkDeviceSize size, VkDeviceSize alignment);
+	// Returns false if only not yet retired reservations are in the way.
+	bool TryReserve(VkDeviceSize size, VkDeviceSize alignment, VulkanStagingRegion &region);
+	void Retire(uint64_t submission);
+
+	bool HasPendingReservations() const { return hasPending; }
+	VkDeviceSize GetCapacity() const { return capacity; }
+
+private:
+	struct Span {
+		uint64_t submission;
+		VkDeviceSize end;
+	};
+
+	bool Fit(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset) const;
+	void Reclaim();
+
+	VulkanDevice &device;
+	std::unique_ptr<VulkanBuffer> buffer;
+	VkDeviceSize capacity;
+
+	VkDeviceSize head = 0;
+	VkDeviceSize tail = 0;
+	bool hasPending = false;
+	std::deque<Span> spans;
+};
@@ -11,17 +11,18 @@
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vulkan/vulkan_core.h>
 
 
 VulkanSwapChain::VulkanSwapChain(VulkanDevice &deviceRef, VkExtent2D extent)
-: device{deviceRef}, windowExtent{extent}
+: device{deviceRef}, windowExtent{extent}, offscreen{deviceRef.IsHeadless()}
 {
 	Init();
 }
 
 VulkanSwapChain::VulkanSwapChain(VulkanDevice &deviceRef, VkExtent2D extent, std::shared_ptr<VulkanSwapChain> previous)
-: device{deviceRef}, windowExtent{extent}, oldSwapChain(previous)
+: device{deviceRef}, windowExtent{extent}, offscreen{deviceRef.IsHeadless()}, oldSwapChain(previous)
 {
 	Init();
 
@@ -30,9 +31,17 @@ VulkanSwapChain::VulkanSwapChain(VulkanDevice &deviceRef, VkExtent2D extent, std
 
 void VulkanSwapChain::Init()
 {
-	CreateSwapChain();
+	if(offscreen)
+		CreateOffscreenImages();
+	else
+		CreateSwapChain();
 	CreateImageViews();
-	CreateRenderPass();
+	renderPassKey = {swapChainImageFormat, FindDepthFormat(), VK_SAMPLE_COUNT_1_BIT};
+	// A resize keeps the formats, in which case only the images, views and framebuffers are new.
+	if(oldSwapChain && oldSwapChain->renderPassKey == renderPassKey)
+		std::swap(renderPass, oldSwapChain->renderPass);
+	else
+		CreateRenderPass();
 	CreateDepthResources();
 	CreateFramebuffers();
 	CreateSyncObjects();
@@ -44,6 +53,12 @@ VulkanSwapChain::~VulkanSwapChain()
 		vkDestroyImageView(device.Device(), imageView, nullptr);
 	swapChainImageViews.clear();
 
+	for(size_t i = 0; i < offscreenImageAllocations.size(); i++)
+	{
+		vkDestroyImage(device.Device(), swapChainImages[i], nullptr);
+		device.FreeAllocation(offscreenImageAllocations[i]);
+	}
+
 	if(swapChain != nullptr)
 	{
 		vkDestroySwapchainKHR(device.Device(), swapChain, nullptr);
@@ -54,12 +69,13 @@ VulkanSwapChain::~VulkanSwapChain()
 	{
 		vkDestroyImageView(device.Device(), depthImageViews[i], nullptr);
 		vkDestroyImage(device.Device(), depthImages[i], nullptr);
-		vkFreeMemory(device.Device(), depthImageMemorys[i], nullptr);
+		device.FreeAllocation(depthImageAllocations[i]);
 	}
 
 	for(auto framebuffer : swapChainFramebuffers)
 		vkDestroyFramebuffer(device.Device(), framebuffer, nullptr);
 
+	// Null if the next swap chain took the render pass over.
 	vkDestroyRenderPass(device.Device(), renderPass, nullptr);
 
 	// cleanup synchronization objects
@@ -67,13 +83,20 @@ VulkanSwapChain::~VulkanSwapChain()
 	{
 		vkDestroySemaphore(device.Device(), renderFinishedSemaphores[i], nullptr);
 		vkDestroySemaphore(device.Device(), imageAvailableSemaphores[i], nullptr);
-		vkDestroyFence(device.Device(), inFlightFences[i], nullptr);
 	}
 }
 
 VkResult VulkanSwapChain::AcquireNextImage(uint32_t *imageIndex)
 {
-	vkWaitForFences(device.Device(), 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	// The acquire semaphore and everything else owned by this frame slot is free once its last frame completed.
+	device.WaitForFrame(framesInFlight[currentFrame]);
+
+	// The offscreen images are a ring with one image per frame slot.
+	if(offscreen)
+	{
+		*imageIndex = static_cast<uint32_t>(currentFrame);
+		return VK_SUCCESS;
+	}
 
 	VkResult result = vkAcquireNextImageKHR(device.Device(), swapChain, std::numeric_limits<uint64_t>::max(),
 			imageAvailableSemaphores[currentFrame],
@@ -84,30 +107,50 @@ VkResult VulkanSwapChain::AcquireNextImage(uint32_t *imageIndex)
 
 VkResult VulkanSwapChain::SubmitCommandBuffers(const VkCommandBuffer *buffers, uint32_t *imageIndex)
 {
-	if(imagesInFlight[*imageIndex] != VK_NULL_HANDLE)
-		vkWaitForFences(device.Device(), 1, &imagesInFlight[*imageIndex], VK_TRUE, UINT64_MAX);
-	imagesInFlight[*imageIndex] = inFlightFences[currentFrame];
+	device.WaitForFrame(imagesInFlight[*imageIndex]);
+
+	uint64_t frame = device.NextFrame();
+	framesInFlight[currentFrame] = frame;
+	imagesInFlight[*imageIndex] = frame;
+
+	// The binary semaphores ignore their values, only the frame timeline uses one.
+	// Offscreen there is nothing to acquire or present, so only the frame timeline is signaled.
+	uint32_t binarySemaphores = offscreen ? 0 : 1;
+	uint64_t waitValues[] = {0};
+	uint64_t signalValues[] = {0, frame};
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = binarySemaphores;
+	timelineInfo.pWaitSemaphoreValues = waitValues;
+	timelineInfo.signalSemaphoreValueCount = 1 + binarySemaphores;
+	timelineInfo.pSignalSemaphoreValues = signalValues + 1 - binarySemaphores;
 
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
 
 	VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
 	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.waitSemaphoreCount = binarySemaphores;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = {buffers};
 
-	VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
+	VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame], device.FrameTimeline()};
+	submitInfo.signalSemaphoreCount = 1 + binarySemaphores;
+	submitInfo.pSignalSemaphores = signalSemaphores + 1 - binarySemaphores;
 
-	vkResetFences(device.Device(), 1, &inFlightFences[currentFrame]);
-	if(vkQueueSubmit(device.GraphicsQueue(), 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+	if(vkQueueSubmit(device.GraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
 		throw std::runtime_error("failed to submit draw command buffer!");
 
+	if(offscreen)
+	{
+		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+		return VK_SUCCESS;
+	}
+
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
@@ -193,6 +236,39 @@ void VulkanSwapChain::CreateSwapChain()
 	swapChainExtent = extent;
 }
 
+void VulkanSwapChain::CreateOffscreenImages()
+{
+	// The formats a surface would most likely offer, so the headless render pass matches the windowed one.
+	swapChainImageFormat = device.FindSupportedFormat(
+			{VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM},
+			VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+	swapChainExtent = windowExtent;
+
+	swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+	offscreenImageAllocations.resize(MAX_FRAMES_IN_FLIGHT);
+	for(size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = swapChainExtent.width;
+		imageInfo.extent.height = swapChainExtent.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = swapChainImageFormat;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		// Transfer source so a frame can be read back.
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.flags = 0;
+
+		device.CreateImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], offscreenImageAllocations[i]);
+	}
+}
+
 void VulkanSwapChain::CreateImageViews()
 {
 	swapChainImageViews.resize(swapChainImages.size());
@@ -217,8 +293,8 @@ void VulkanSwapChain::CreateImageViews()
 void VulkanSwapChain::CreateRenderPass()
 {
 	VkAttachmentDescription depthAttachment{};
-	depthAttachment.format = FindDepthFormat();
-	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.format = renderPassKey.depthFormat;
+	depthAttachment.samples = renderPassKey.samples;
 	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -231,14 +307,15 @@ void VulkanSwapChain::CreateRenderPass()
 	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentDescription colorAttachment = {};
-	colorAttachment.format = GetSwapChainImageFormat();
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.format = renderPassKey.colorFormat;
+	colorAttachment.samples = renderPassKey.samples;
 	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// The final layout does not affect render pass compatibility, pipelines work with either.
+	colorAttachment.finalLayout = offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentRef = {};
 	colorAttachmentRef.attachment = 0;
@@ -296,11 +373,11 @@ void VulkanSwapChain::CreateFramebuffers()
 
 void VulkanSwapChain::CreateDepthResources()
 {
-	VkFormat depthFormat = FindDepthFormat();
+	VkFormat depthFormat = renderPassKey.depthFormat;
 	VkExtent2D swapChainExtent = GetSwapChainExtent();
 
 	depthImages.resize(ImageCount());
-	depthImageMemorys.resize(ImageCount());
+	depthImageAllocations.resize(ImageCount());
 	depthImageViews.resize(ImageCount());
 
 	for(int i = 0; i < depthImages.size(); i++)
@@ -317,11 +394,11 @@ void VulkanSwapChain::CreateDepthResources()
 		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
 		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.samples = renderPassKey.samples;
 		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 		imageInfo.flags = 0;
 
-		device.CreateImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImages[i], depthImageMemorys[i]);
+		device.CreateImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImages[i], depthImageAllocations[i]);
 
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -343,21 +420,16 @@ void VulkanSwapChain::CreateSyncObjects()
 {
 	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
 	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-	imagesInFlight.resize(ImageCount(), VK_NULL_HANDLE);
+	framesInFlight.resize(MAX_FRAMES_IN_FLIGHT, 0);
+	imagesInFlight.resize(ImageCount(), 0);
 
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	VkFenceCreateInfo fenceInfo = {};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
 	for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
 		if(vkCreateSemaphore(device.Device(), &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(device.Device(), &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(device.Device(), &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
+			vkCreateSemaphore(device.Device(), &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS)
 			throw std::runtime_error("failed to create synchronization objects for a frame!");
 	}
 }
@@ -9,10 +9,26 @@
 #include <vector>
 
 
+// The images frames are rendered into. On a headless device there is no surface to present to, the swap chain
+// is replaced by a ring of owned offscreen images, one per frame in flight, behind the same render pass.
 class VulkanSwapChain {
 public:
 	static constexpr int MAX_FRAMES_IN_FLIGHT = 3;
 
+	// Everything render pass compatibility depends on. Pipelines created for one render pass can be used with
+	// any render pass of an equal key, so they survive swap chain recreation as long as the key does not change.
+	struct RenderPassKey {
+		VkFormat colorFormat;
+		VkFormat depthFormat;
+		VkSampleCountFlagBits samples;
+
+		bool operator==(const RenderPassKey &other) const
+		{
+			return colorFormat == other.colorFormat && depthFormat == other.depthFormat && samples == other.samples;
+		}
+		bool operator!=(const RenderPassKey &other) const { return !(*this == other); }
+	};
+
 	VulkanSwapChain(VulkanDevice &deviceRef, VkExtent2D windowExtent);
 	VulkanSwapChain(VulkanDevice &deviceRef, VkExtent2D windowExtent, std::shared_ptr<VulkanSwapChain> previous);
 	~VulkanSwapChain();
@@ -22,6 +38,7 @@ public:
 
 	VkFramebuffer GetFrameBuffer(int index) { return swapChainFramebuffers[index]; }
 	VkRenderPass GetRenderPass() { return renderPass; }
+	const RenderPassKey &GetRenderPassKey() const { return renderPassKey; }
 	VkImageView GetImageView(int index) { return swapChainImageViews[index]; }
 	size_t ImageCount() { return swapChainImages.size(); }
 	VkFormat GetSwapChainImageFormat() { return swapChainImageFormat; }
@@ -29,6 +46,9 @@ public:
 	uint32_t Width() { return swapChainExtent.width; }
 	uint32_t Height() { return swapChainExtent.height; }
 
+	uint32_t GetCurrentFrame() { return static_cast<uint32_t>(currentFrame); }
+	bool IsOffscreen() const { return offscreen; }
+
 	float ExtentAspectRatio() { return static_cast<float>(swapChainExtent.width) / static_cast<float>(swapChainExtent.height); }
 	VkFormat FindDepthFormat();
 
@@ -38,6 +58,7 @@ public:
 private:
 	void Init();
 	void CreateSwapChain();
+	void CreateOffscreenImages();
 	void CreateImageViews();
 	void CreateDepthResources();
 	void CreateRenderPass();
@@ -52,23 +73,29 @@ private:
 	VkExtent2D swapChainExtent;
 
 	std::vector<VkFramebuffer> swapChainFramebuffers;
-	VkRenderPass renderPass;
+	RenderPassKey renderPassKey;
+	// Taken over from the previous swap chain if the keys match, which leaves it with a null handle.
+	VkRenderPass renderPass = VK_NULL_HANDLE;
 
 	std::vector<VkImage> depthImages;
-	std::vector<VkDeviceMemory> depthImageMemorys;
+	std::vector<VulkanAllocation> depthImageAllocations;
 	std::vector<VkImageView> depthImageViews;
 	std::vector<VkImage> swapChainImages;
 	std::vector<VkImageView> swapChainImageViews;
+	// Only filled in offscreen, swap chain images belong to the swap chain.
+	std::vector<VulkanAllocation> offscreenImageAllocations;
 
 	VulkanDevice &device;
 	VkExtent2D windowExtent;
+	bool offscreen;
 
-	VkSwapchainKHR swapChain;
+	VkSwapchainKHR swapChain = VK_NULL_HANDLE;
 	std::shared_ptr<VulkanSwapChain> oldSwapChain;
 
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
-	std::vector<VkFence> inFlightFences;
-	std::vector<VkFence> imagesInFlight;
+	// Frame numbers on the device's frame timeline that last used a frame slot or swap chain image.
+	std::vector<uint64_t> framesInFlight;
+	std::vector<uint64_t> imagesInFlight;
 	size_t currentFrame = 0;
 };
@@ -1,47 +1,43 @@
 #include "vulkan_texture.h"
 
 #include "source/logger.h"
-#include "vulkan_buffer.h"
-#include "vulkan_buffer.h"
+#include "vulkan_staging_ring.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "external/stb_image.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <memory>
 #include <string>
 #include <stdexcept>
 #include <vulkan/vulkan_core.h>
 
 
 
-VulkanTexture::VulkanTexture(VulkanDevice &device, const std::vector<std::string> &filepaths)
+VulkanTexture::VulkanTexture(VulkanDevice &device, VulkanUploadBatch &uploads, const std::vector<std::string> &filepaths)
 : device{device}
 {
 	int channels;
-	int m_BytesPerPixel;
 
-	std::vector<stbi_uc> loadVector;
+	// Freed on every path out of here, including the throws below.
+	std::vector<std::unique_ptr<stbi_uc, void (*)(void *)>> layers;
 	for(const auto &filepath : filepaths)
 	{
-		stbi_uc *ndata = stbi_load(filepath.c_str(), &width, &height, &channels, 4);
-		for(int i = 0; i < width * height * channels; i++)
-			loadVector.emplace_back(ndata[i]);
+		int layerWidth, layerHeight;
+		layers.emplace_back(stbi_load(filepath.c_str(), &layerWidth, &layerHeight, &channels, 4), stbi_image_free);
+		if(!layers.back())
+			throw std::runtime_error("failed to load texture image: " + filepath);
+		// Every file becomes one layer of the image array, so they all need the same size.
+		if(layers.size() > 1 && (layerWidth != width || layerHeight != height))
+			throw std::runtime_error("texture layer has a different size: " + filepath);
+		width = layerWidth;
+		height = layerHeight;
 	}
-	stbi_uc *data = loadVector.data();//stbi_load(filepath.c_str(), &width, &height, &channels, 4);
+	uint32_t layerCount = static_cast<uint32_t>(layers.size());
 
 	mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
 
-	VulkanBuffer stagingBuffer{
-		device,
-		4,
-		static_cast<uint32_t>(width * height),
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	};
-
-	stagingBuffer.Map();
-	stagingBuffer.WriteToBuffer(data);
-
 	imageFormat = VK_FORMAT_R8G8B8A8_SRGB;
 
 	VkImageCreateInfo imageInfo = {};
@@ -49,7 +45,7 @@ VulkanTexture::VulkanTexture(VulkanDevice &device, const std::vector<std::string
 	imageInfo.imageType = VK_IMAGE_TYPE_2D;
 	imageInfo.format = imageFormat;
 	imageInfo.mipLevels = mipLevels;
-	imageInfo.arrayLayers = 1;
+	imageInfo.arrayLayers = layerCount;
 	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
 	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -58,13 +54,21 @@ VulkanTexture::VulkanTexture(VulkanDevice &device, const std::vector<std::string
 	imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 
 
-	device.CreateImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+	device.CreateImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageAllocation);
 
-	TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	uploads.TransitionImageLayout(image, mipLevels, layerCount, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-	device.CopyBufferToImage(stagingBuffer.GetBuffer(), image, static_cast<uint>(width), static_cast<uint>(height), 1);
+	// Copy the decoded layers into the staging ring, so loading a texture allocates no host visible memory.
+	VkDeviceSize layerSize = static_cast<VkDeviceSize>(width) * height * 4;
+	VkDeviceSize copyAlignment = std::max<VkDeviceSize>(device.properties.limits.optimalBufferCopyOffsetAlignment, 4);
+	VulkanStagingRegion staging = uploads.Reserve(layerSize * layers.size(), copyAlignment);
+	for(size_t i = 0; i < layers.size(); i++)
+		memcpy(static_cast<char *>(staging.data) + i * layerSize, layers[i].get(), layerSize);
+	layers.clear();
 
-	GenerateMipmaps();
+	uploads.CopyBufferToImage(staging.buffer, image, static_cast<uint>(width), static_cast<uint>(height), layerCount, staging.offset);
+
+	uploads.GenerateMipmaps(image, imageFormat, width, height, mipLevels, layerCount);
 	imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
 	VkSamplerCreateInfo samplerInfo{};
@@ -93,7 +97,7 @@ VulkanTexture::VulkanTexture(VulkanDevice &device, const std::vector<std::string
 	imageViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	imageViewInfo.subresourceRange.baseMipLevel = 0;
 	imageViewInfo.subresourceRange.baseArrayLayer = 0;
-	imageViewInfo.subresourceRange.layerCount = 1;
+	imageViewInfo.subresourceRange.layerCount = layerCount;
 	imageViewInfo.subresourceRange.levelCount = mipLevels;
 	imageViewInfo.image = image;
 
@@ -108,126 +112,7 @@ VulkanTexture::VulkanTexture(VulkanDevice &device, const std::vector<std::string
 VulkanTexture::~VulkanTexture()
 {
 	vkDestroyImage(device.Device(), image, nullptr);
-	vkFreeMemory(device.Device(), imageMemory, nullptr);
+	device.FreeAllocation(imageAllocation);
 	vkDestroyImageView(device.Device(), imageView, nullptr);
 	vkDestroySampler(device.Device(), sampler, nullptr);
 }
-
-
-
-void VulkanTexture::TransitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-	VkCommandBuffer commandBuffer = device.BeginSingleTimeCommands();
-
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = mipLevels;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags sourceStage;
-	VkPipelineStageFlags destinationStage;
-
-	if(oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-	{
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	}
-	else if(oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-	{
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-	else
-		throw std::runtime_error("unsupported layout transition!");
-
-	vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-	device.EndSingleTimeCommands(commandBuffer);
-}
-
-
-
-void VulkanTexture::GenerateMipmaps()
-{
-	VkFormatProperties formatProperties;
-	vkGetPhysicalDeviceFormatProperties(device.GetPhysicalDevice(), imageFormat, &formatProperties);
-
-	if(!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
-		throw std::runtime_error("texture image format does not support linear blitting!");
-
-	VkCommandBuffer commandBuffer = device.BeginSingleTimeCommands();
-
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.image = image;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.subresourceRange.levelCount = 1;
-
-	int32_t mipWidth = width;
-	int32_t mipHeight = height;
-
-	for(uint32_t i = 1; i < mipLevels; i++)
-	{
-		barrier.subresourceRange.baseMipLevel = i - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-		VkImageBlit blit{};
-		blit.srcOffsets[0] = {0, 0, 0};
-		blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.srcSubresource.mipLevel = i - 1;
-		blit.srcSubresource.baseArrayLayer = 0;
-		blit.srcSubresource.layerCount = 1;
-		blit.dstOffsets[0] = {0, 0, 0};
-		blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
-		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.dstSubresource.mipLevel = i;
-		blit.dstSubresource.baseArrayLayer = 0;
-		blit.dstSubresource.layerCount = 1;
-
-		vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-		if(mipWidth > 1) mipWidth /= 2;
-		if(mipHeight > 1) mipHeight /= 2;
-	}
-
-	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-	device.EndSingleTimeCommands(commandBuffer);
-}
\ No newline at end of file
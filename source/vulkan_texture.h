@@ -1,13 +1,14 @@
 #pragma once
 
 #include "vulkan_device.h"
+#include "vulkan_upload_batch.h"
 
 #include <string.h>
 #include <vulkan/vulkan_core.h>
 
 class VulkanTexture {
 public:
-	VulkanTexture(VulkanDevice &device, const std::vector<std::string> &filepaths);
+	VulkanTexture(VulkanDevice &device, VulkanUploadBatch &uploads, const std::vector<std::string> &filepaths);
 	~VulkanTexture();
 
 	VulkanTexture(const VulkanTexture &) = delete;
@@ -19,14 +20,11 @@ public:
 	VkImageView GetImageView() { return imageView; }
 	VkImageLayout GetImageLayout() { return imageLayout; }
 private:
-	void TransitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout);
-	void GenerateMipmaps();
-
 	int width, height, mipLevels;
 
 	VulkanDevice &device;
 	VkImage image;
-	VkDeviceMemory imageMemory;
+	VulkanAllocation imageAllocation;
 	VkImageView imageView;
 	VkSampler sampler;
 	VkFormat imageFormat;
@@ -0,0 +1,70 @@
+#include "vulkan_texture_registry.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+
+
+VulkanTextureRegistry::VulkanTextureRegistry(VulkanDevice &device)
+: device{device}
+{
+	VkPhysicalDeviceVulkan12Properties vulkan12Properties{};
+	vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &vulkan12Properties;
+	vkGetPhysicalDeviceProperties2(device.GetPhysicalDevice(), &properties);
+
+	// Combined image samplers count against both the sampler and the sampled image limits.
+	capacity = std::min({MAX_TEXTURES,
+		vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages,
+		vulkan12Properties.maxDescriptorSetUpdateAfterBindSamplers,
+		vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+	descriptorSetLayout = VulkanDescriptorSetLayout::Builder(device)
+		.AddBinding(BINDING, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, capacity,
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+			| VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT)
+		.Build();
+	descriptorPool = VulkanDescriptorPool::Builder(device)
+		.SetMaxSets(1)
+		.SetPoolFlags(VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT)
+		.AddPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, capacity)
+		.Build();
+
+	if(!VulkanDescriptorWriter(*descriptorSetLayout, *descriptorPool).Build(descriptorSet, capacity))
+		throw std::runtime_error("failed to allocate bindless texture descriptor set!");
+
+	Logger::Status("Bindless texture table holds up to " + std::to_string(capacity) + " textures");
+}
+
+
+
+VulkanTextureRegistry::~VulkanTextureRegistry() { }
+
+
+
+uint32_t VulkanTextureRegistry::LoadTexture(VulkanUploadBatch &uploads, const std::vector<std::string> &filepaths)
+{
+	if(textures.size() >= capacity)
+		throw std::runtime_error("bindless texture table is full!");
+
+	textures.emplace_back(std::make_unique<VulkanTexture>(device, uploads, filepaths));
+	uint32_t index = static_cast<uint32_t>(textures.size() - 1);
+
+	// Partially bound, so only the new slot needs writing. Shaders must not use it before the upload completed,
+	// which holds because draws only ever follow the upload batch on the graphics queue.
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.imageLayout = textures.back()->GetImageLayout();
+	imageInfo.imageView = textures.back()->GetImageView();
+	imageInfo.sampler = textures.back()->GetSampler();
+	VulkanDescriptorWriter(*descriptorSetLayout, *descriptorPool)
+		.WriteImage(BINDING, &imageInfo, index)
+		.Overwrite(descriptorSet);
+
+	return index;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "vulkan_descriptors.h"
+#include "vulkan_device.h"
+#include "vulkan_texture.h"
+#include "vulkan_upload_batch.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Global bindless texture table: one descriptor set holding a runtime sized sampler2DArray array, which shaders
+// index with a per draw or per instance texture index. The set is bound once per frame for every textured draw.
+// Slots are written with update after bind, so textures can be added while earlier frames are still in flight.
+class VulkanTextureRegistry {
+public:
+	// Where shaders declare the table, layout(set = 1, binding = 1).
+	static constexpr uint32_t SET = 1;
+	static constexpr uint32_t BINDING = 1;
+	static constexpr uint32_t MAX_TEXTURES = 4096;
+
+	VulkanTextureRegistry(VulkanDevice &device);
+	~VulkanTextureRegistry();
+
+	VulkanTextureRegistry(const VulkanTextureRegistry &) = delete;
+	VulkanTextureRegistry &operator=(const VulkanTextureRegistry &) = delete;
+
+	// Returns the texture's index in the table, which stays valid for the lifetime of the registry.
+	uint32_t LoadTexture(VulkanUploadBatch &uploads, const std::vector<std::string> &filepaths);
+
+	VulkanDescriptorSetLayout &GetDescriptorSetLayout() { return *descriptorSetLayout; }
+	VkDescriptorSet GetDescriptorSet() const { return descriptorSet; }
+	uint32_t GetTextureCount() const { return static_cast<uint32_t>(textures.size()); }
+	uint32_t GetCapacity() const { return capacity; }
+
+private:
+	VulkanDevice &device;
+	uint32_t capacity;
+
+	std::unique_ptr<VulkanDescriptorSetLayout> descriptorSetLayout;
+	std::unique_ptr<VulkanDescriptorPool> descriptorPool;
+	VkDescriptorSet descriptorSet;
+
+	std::vector<std::unique_ptr<VulkanTexture>> textures;
+};
@@ -0,0 +1,120 @@
+#include "vulkan_uniform_ring.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+
+
+namespace {
+	VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+
+
+VulkanUniformRing::VulkanUniformRing(VulkanDevice &device, VulkanDescriptorSetLayout &setLayout, VkDeviceSize bindingRange,
+	uint32_t frameCount, VkDeviceSize pageSize)
+: device{device}, setLayout{setLayout}, bindingRange{bindingRange}, frames(frameCount)
+{
+	alignment = std::max<VkDeviceSize>(device.properties.limits.minUniformBufferOffsetAlignment, 1);
+	this->pageSize = AlignUp(std::max(pageSize, bindingRange), alignment);
+
+	for(uint32_t i = 0; i < frameCount; i++)
+	{
+		currentFrame = i;
+		AddPage(this->pageSize);
+	}
+	currentFrame = 0;
+}
+
+
+
+VulkanUniformRing::~VulkanUniformRing() { }
+
+
+
+void VulkanUniformRing::BeginFrame(uint32_t frameIndex)
+{
+	assert(frameIndex < frames.size() && "Frame index out of range");
+
+	currentFrame = frameIndex;
+	currentPage = 0;
+	for(auto &page : frames[currentFrame])
+		page->head = 0;
+}
+
+
+
+VulkanUniformAllocation VulkanUniformRing::Allocate(VkDeviceSize size)
+{
+	// The descriptor always covers bindingRange bytes behind the dynamic offset, so that much has to fit.
+	VkDeviceSize footprint = std::max(size, bindingRange);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto &pages = frames[currentFrame];
+	while(currentPage < pages.size())
+	{
+		Page &page = *pages[currentPage];
+		VkDeviceSize offset = AlignUp(page.head, alignment);
+		if(offset + footprint <= page.buffer->GetBufferSize())
+		{
+			page.head = offset + size;
+			return {static_cast<char *>(page.buffer->GetMappedMemory()) + offset, static_cast<uint32_t>(offset), page.descriptorSet};
+		}
+		currentPage++;
+	}
+
+	Page &page = AddPage(footprint);
+	page.head = size;
+	return {page.buffer->GetMappedMemory(), 0, page.descriptorSet};
+}
+
+
+
+VulkanUniformAllocation VulkanUniformRing::Write(const void *data, VkDeviceSize size)
+{
+	VulkanUniformAllocation allocation = Allocate(size);
+	memcpy(allocation.data, data, size);
+	return allocation;
+}
+
+
+
+void VulkanUniformRing::Flush()
+{
+	auto &pages = frames[currentFrame];
+	for(size_t i = 0; i <= currentPage && i < pages.size(); i++)
+		if(pages[i]->head)
+			pages[i]->buffer->Flush(pages[i]->head, 0);
+}
+
+
+
+VulkanUniformRing::Page &VulkanUniformRing::AddPage(VkDeviceSize minimumSize)
+{
+	auto page = std::make_unique<Page>();
+	page->buffer = std::make_unique<VulkanBuffer>(
+		device,
+		std::max(pageSize, AlignUp(minimumSize, alignment)),
+		1,
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	page->buffer->Map();
+
+	page->descriptorPool = VulkanDescriptorPool::Builder(device)
+		.SetMaxSets(1)
+		.AddPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1)
+		.Build();
+	auto bufferInfo = page->buffer->DescriptorInfo(bindingRange, 0);
+	VulkanDescriptorWriter(setLayout, *page->descriptorPool)
+		.WriteBuffer(0, &bufferInfo)
+		.Build(page->descriptorSet);
+
+	auto &pages = frames[currentFrame];
+	pages.emplace_back(std::move(page));
+	currentPage = pages.size() - 1;
+	return *pages.back();
+}
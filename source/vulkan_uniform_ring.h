@@ -0,0 +1,67 @@
+#pragma once
+
+#include "vulkan_buffer.h"
+#include "vulkan_descriptors.h"
+#include "vulkan_device.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+struct VulkanUniformAllocation {
+	void *data;
+	uint32_t dynamicOffset;
+	VkDescriptorSet descriptorSet;
+};
+
+// Persistently mapped, per frame in flight bump allocator for dynamic uniform buffers.
+// Every page has a single descriptor set, so draws only differ in their dynamic offset.
+// A set per page rather than per pipeline: a descriptor set names one buffer, and a single buffer could not grow
+// without rewriting a set that frames in flight are still reading.
+// When a frame runs out of space it spills into further pages, which are kept for later frames.
+class VulkanUniformRing {
+public:
+	static constexpr VkDeviceSize DEFAULT_PAGE_SIZE = 64 * 1024;
+
+	VulkanUniformRing(VulkanDevice &device, VulkanDescriptorSetLayout &setLayout, VkDeviceSize bindingRange,
+		uint32_t frameCount, VkDeviceSize pageSize = DEFAULT_PAGE_SIZE);
+	~VulkanUniformRing();
+
+	VulkanUniformRing(const VulkanUniformRing &) = delete;
+	VulkanUniformRing &operator=(const VulkanUniformRing &) = delete;
+
+	// Must only be called once the fence of the given frame has been waited on.
+	void BeginFrame(uint32_t frameIndex);
+	// Allocate and Write may be called from several recording threads at once.
+	VulkanUniformAllocation Allocate(VkDeviceSize size);
+	VulkanUniformAllocation Write(const void *data, VkDeviceSize size);
+	// Makes every block written during the current frame visible to the device.
+	void Flush();
+
+	size_t GetPageCount(uint32_t frameIndex) const { return frames[frameIndex].size(); }
+
+private:
+	struct Page {
+		std::unique_ptr<VulkanBuffer> buffer;
+		std::unique_ptr<VulkanDescriptorPool> descriptorPool;
+		VkDescriptorSet descriptorSet;
+		VkDeviceSize head = 0;
+	};
+
+	Page &AddPage(VkDeviceSize minimumSize);
+
+	VulkanDevice &device;
+	VulkanDescriptorSetLayout &setLayout;
+	VkDeviceSize bindingRange;
+	VkDeviceSize pageSize;
+	VkDeviceSize alignment;
+
+	std::vector<std::vector<std::unique_ptr<Page>>> frames;
+	uint32_t currentFrame = 0;
+	size_t currentPage = 0;
+	std::mutex mutex;
+};
@@ -0,0 +1,368 @@
+#include "vulkan_upload_batch.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+
+
+VulkanUploadBatch::VulkanUploadBatch(VulkanDevice &device)
+: device{device}
+{
+}
+
+
+
+VulkanUploadBatch::~VulkanUploadBatch()
+{
+	// Destructors must not throw, a batch that fails to submit here is dropped. Call Submit() to see the error.
+	try
+	{
+		Submit();
+	}
+	catch(const std::exception &error)
+	{
+		Logger::Error(std::string("Dropped an upload batch that failed to submit: ") + error.what());
+	}
+}
+
+
+
+VulkanStagingRegion VulkanUploadBatch::Reserve(VkDeviceSize size, VkDeviceSize alignment)
+{
+	VulkanStagingRing &ring = device.StagingRing();
+
+	VulkanStagingRegion region;
+	if(ring.TryReserve(size, alignment, region))
+		return region;
+
+	// Only our own, not yet submitted data is in the way. Submit it, so that the ring can recycle it later.
+	if(ring.HasPendingReservations())
+		Submit();
+	return ring.Reserve(size, alignment);
+}
+
+
+
+VulkanStagingRegion VulkanUploadBatch::Stage(const void *data, VkDeviceSize size, VkDeviceSize alignment)
+{
+	VulkanStagingRegion region = Reserve(size, alignment);
+	memcpy(region.data, data, size);
+	return region;
+}
+
+
+
+void VulkanUploadBatch::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
+{
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(TransferCommandBuffer(), srcBuffer, dstBuffer, 1, &copyRegion);
+
+	if(std::find(copiedBuffers.begin(), copiedBuffers.end(), dstBuffer) == copiedBuffers.end())
+		copiedBuffers.push_back(dstBuffer);
+}
+
+
+
+void VulkanUploadBatch::CopyConcurrentBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset,
+	VkDeviceSize dstOffset)
+{
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(TransferCommandBuffer(), srcBuffer, dstBuffer, 1, &copyRegion);
+
+	copiedConcurrentBuffers = true;
+}
+
+
+
+void VulkanUploadBatch::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount,
+	VkDeviceSize bufferOffset)
+{
+	VkBufferImageCopy region{};
+	region.bufferOffset = bufferOffset;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = layerCount;
+
+	region.imageOffset = {0, 0, 0};
+	region.imageExtent = {width, height, 1};
+
+	vkCmdCopyBufferToImage(
+			TransferCommandBuffer(),
+			buffer,
+			image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1,
+			&region);
+}
+
+
+
+void VulkanUploadBatch::TransitionImageLayout(VkImage image, uint32_t mipLevels, uint32_t layerCount, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+	if(oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	{
+		TransferImageOwnership(image, mipLevels, layerCount, oldLayout, newLayout,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		return;
+	}
+	if(oldLayout != VK_IMAGE_LAYOUT_UNDEFINED || newLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+		throw std::runtime_error("unsupported layout transition!");
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(TransferCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+
+
+void VulkanUploadBatch::GenerateMipmaps(VkImage image, VkFormat format, int32_t width, int32_t height, uint32_t mipLevels, uint32_t layerCount)
+{
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(device.GetPhysicalDevice(), format, &formatProperties);
+
+	if(!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+		throw std::runtime_error("texture image format does not support linear blitting!");
+
+	// Blits need a graphics queue, so the copied base level moves over to it first.
+	TransferImageOwnership(image, mipLevels, layerCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	VkCommandBuffer commandBuffer = GraphicsCommandBuffer();
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = image;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+	barrier.subresourceRange.levelCount = 1;
+
+	int32_t mipWidth = width;
+	int32_t mipHeight = height;
+
+	for(uint32_t i = 1; i < mipLevels; i++)
+	{
+		barrier.subresourceRange.baseMipLevel = i - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkImageBlit blit{};
+		blit.srcOffsets[0] = {0, 0, 0};
+		blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = i - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = layerCount;
+		blit.dstOffsets[0] = {0, 0, 0};
+		blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = i;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = layerCount;
+
+		vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		if(mipWidth > 1) mipWidth /= 2;
+		if(mipHeight > 1) mipHeight /= 2;
+	}
+
+	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+
+
+uint64_t VulkanUploadBatch::Submit()
+{
+	if(transferCommandBuffer == VK_NULL_HANDLE && graphicsCommandBuffer == VK_NULL_HANDLE)
+		return lastSubmission;
+
+	const VkAccessFlags bufferReadAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT;
+	const VkPipelineStageFlags bufferReadStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+	if(!copiedBuffers.empty() && device.HasDedicatedTransferQueue())
+	{
+		const QueueFamilyIndices &indices = device.FindPhysicalQueueFamilies();
+
+		std::vector<VkBufferMemoryBarrier> barriers(copiedBuffers.size());
+		for(size_t i = 0; i < copiedBuffers.size(); i++)
+		{
+			barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[i].dstAccessMask = 0;
+			barriers[i].srcQueueFamilyIndex = indices.transferFamily;
+			barriers[i].dstQueueFamilyIndex = indices.graphicsFamily;
+			barriers[i].buffer = copiedBuffers[i];
+			barriers[i].offset = 0;
+			barriers[i].size = VK_WHOLE_SIZE;
+		}
+		vkCmdPipelineBarrier(TransferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+
+		for(auto &barrier : barriers)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = bufferReadAccess;
+		}
+		vkCmdPipelineBarrier(GraphicsCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, bufferReadStages,
+			0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+	}
+	if((!copiedBuffers.empty() && !device.HasDedicatedTransferQueue()) || copiedConcurrentBuffers)
+	{
+		// Later frames are behind this submission on the same queue, one barrier makes all buffer copies visible to them.
+		// Copies into concurrent buffers on the transfer queue reach it through the semaphore wait before it.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = bufferReadAccess;
+		vkCmdPipelineBarrier(GraphicsCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, bufferReadStages,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	if(transferCommandBuffer != VK_NULL_HANDLE && vkEndCommandBuffer(transferCommandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record transfer command buffer!");
+	if(graphicsCommandBuffer != VK_NULL_HANDLE && vkEndCommandBuffer(graphicsCommandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record upload command buffer!");
+
+	lastSubmission = device.SubmitUpload(graphicsCommandBuffer, transferCommandBuffer);
+	device.StagingRing().Retire(lastSubmission);
+	submitCount++;
+
+	transferCommandBuffer = VK_NULL_HANDLE;
+	graphicsCommandBuffer = VK_NULL_HANDLE;
+	copiedBuffers.clear();
+	copiedConcurrentBuffers = false;
+	return lastSubmission;
+}
+
+
+
+void VulkanUploadBatch::TransferImageOwnership(VkImage image, uint32_t mipLevels, uint32_t layerCount, VkImageLayout oldLayout,
+	VkImageLayout newLayout, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+
+	if(!device.HasDedicatedTransferQueue())
+	{
+		if(oldLayout != newLayout)
+			vkCmdPipelineBarrier(GraphicsCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		return;
+	}
+
+	// Release and acquire must describe the same layout transition, the transition itself happens once in between.
+	const QueueFamilyIndices &indices = device.FindPhysicalQueueFamilies();
+	barrier.srcQueueFamilyIndex = indices.transferFamily;
+	barrier.dstQueueFamilyIndex = indices.graphicsFamily;
+
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(TransferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccess;
+	vkCmdPipelineBarrier(GraphicsCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+
+
+VkCommandBuffer VulkanUploadBatch::BeginCommandBuffer(VkCommandPool pool)
+{
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = pool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if(vkAllocateCommandBuffers(device.Device(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate upload command buffer!");
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	return commandBuffer;
+}
+
+
+
+VkCommandBuffer VulkanUploadBatch::TransferCommandBuffer()
+{
+	// Without a dedicated transfer queue everything is recorded into the graphics command buffer.
+	if(!device.HasDedicatedTransferQueue())
+		return GraphicsCommandBuffer();
+
+	if(transferCommandBuffer == VK_NULL_HANDLE)
+		transferCommandBuffer = BeginCommandBuffer(device.GetTransferCommandPool());
+	return transferCommandBuffer;
+}
+
+
+
+VkCommandBuffer VulkanUploadBatch::GraphicsCommandBuffer()
+{
+	if(graphicsCommandBuffer == VK_NULL_HANDLE)
+		graphicsCommandBuffer = BeginCommandBuffer(device.GetCommandPool());
+	return graphicsCommandBuffer;
+}
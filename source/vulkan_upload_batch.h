@@ -0,0 +1,61 @@
+#pragma once
+
+#include "vulkan_device.h"
+#include "vulkan_staging_ring.h"
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+
+
+// Records any number of buffer/image copies, layout transitions and mip generations into one command buffer,
+// which is submitted once. The returned submission number can be polled or waited on through the VulkanDevice.
+// If the device has a dedicated transfer queue, copies run there and ownership of the written resources is
+// released to the graphics family, which acquires it (and generates mipmaps) in a second, much smaller submission.
+class VulkanUploadBatch {
+public:
+	VulkanUploadBatch(VulkanDevice &device);
+	~VulkanUploadBatch();
+
+	VulkanUploadBatch(const VulkanUploadBatch &) = delete;
+	VulkanUploadBatch &operator=(const VulkanUploadBatch &) = delete;
+
+	// Reserves staging memory, submitting the batch early if its own reservations filled the staging ring.
+	VulkanStagingRegion Reserve(VkDeviceSize size, VkDeviceSize alignment = 4);
+	VulkanStagingRegion Stage(const void *data, VkDeviceSize size, VkDeviceSize alignment = 4);
+
+	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+	// For buffers created with concurrent sharing, which other submissions may still be reading from.
+	// Their ownership is never transferred, the copy only has to become visible to later frames.
+	void CopyConcurrentBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0,
+		VkDeviceSize dstOffset = 0);
+	void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount,
+		VkDeviceSize bufferOffset = 0);
+	void TransitionImageLayout(VkImage image, uint32_t mipLevels, uint32_t layerCount, VkImageLayout oldLayout, VkImageLayout newLayout);
+	// Expects every level in TRANSFER_DST_OPTIMAL and leaves every level in SHADER_READ_ONLY_OPTIMAL.
+	void GenerateMipmaps(VkImage image, VkFormat format, int32_t width, int32_t height, uint32_t mipLevels, uint32_t layerCount);
+
+	// Submits everything recorded so far. Returns the last submission if nothing was recorded.
+	uint64_t Submit();
+
+	uint64_t GetLastSubmission() const { return lastSubmission; }
+	uint32_t GetSubmitCount() const { return submitCount; }
+
+private:
+	VkCommandBuffer BeginCommandBuffer(VkCommandPool pool);
+	VkCommandBuffer TransferCommandBuffer();
+	VkCommandBuffer GraphicsCommandBuffer();
+	// Hands the image over from the transfer to the graphics family, or records a plain barrier without a transfer queue.
+	void TransferImageOwnership(VkImage image, uint32_t mipLevels, uint32_t layerCount, VkImageLayout oldLayout,
+		VkImageLayout newLayout, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
+	VulkanDevice &device;
+	VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+	VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+	std::vector<VkBuffer> copiedBuffers;
+	bool copiedConcurrentBuffers = false;
+
+	uint64_t lastSubmission = 0;
+	uint32_t submitCount = 0;
+};
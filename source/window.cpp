@@ -6,16 +6,19 @@
 
 
 
-Window::Window(int width, int height, std::string name)
+Window::Window(int width, int height, std::string name, bool headless)
 : width(width), height(height), windowName(name)
 {
-	InitWindow();
+	if(!headless)
+		InitWindow();
 }
 
 
 
 Window::~Window()
 {
+	if(!window)
+		return;
 	glfwDestroyWindow(window);
 	glfwTerminate();
 }
@@ -10,7 +10,8 @@
 
 class Window {
 public:
-	Window(int width, int height, std::string name);
+	// A headless window has no GLFW window behind it, only a size for the offscreen images.
+	Window(int width, int height, std::string name, bool headless = false);
 	~Window();
 
 
@@ -20,7 +21,8 @@ public:
 	void CreateWindowSurface(VkInstance instance, VkSurfaceKHR *surface);
 
 	GLFWwindow *GetWindow() { return window; }
-	bool ShouldClose() { return glfwWindowShouldClose(window); }
+	bool IsHeadless() const { return window == nullptr; }
+	bool ShouldClose() { return window && glfwWindowShouldClose(window); }
 	VkExtent2D GetExtent() { return {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};}
 	bool WasWindowResized() { return framebufferResized; }
 	void ResetWindowResizedFlag() { framebufferResized = false; }
@@ -34,6 +36,6 @@ private:
 	bool framebufferResized = false;
 
 	std::string windowName;
-	GLFWwindow *window;
+	GLFWwindow *window = nullptr;
 
 };
\ No newline at end of file